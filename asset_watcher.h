@@ -0,0 +1,338 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "gl_state.h"
+#include "shader.h"
+#include "texture.h"
+
+// Watches shader sources and textures for changes and rebuilds them on a background thread.
+//
+// The worker owns a hidden window whose context shares objects with the main one, so reading, decoding, compiling
+// and uploading all happen off the frame. Finished objects are queued and apply() only swaps the ids on the GL
+// thread, a failed compile leaves the old program in place.
+class AssetWatcher
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    AssetWatcher(GLFWwindow* window)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "asset watcher", nullptr, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (!context)
+        {
+            std::cout << "WARNING::ASSET_WATCHER::NO_SHARED_CONTEXT, hot reload disabled" << std::endl;
+        }
+    }
+
+    ~AssetWatcher() { stop(); }
+
+    AssetWatcher(const AssetWatcher&) = delete;
+    AssetWatcher& operator=(const AssetWatcher&) = delete;
+
+    // Join the worker and release its context, must run before glfwTerminate()
+    void stop()
+    {
+        running = false;
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+        for (auto& reload : ready)
+        {
+            if (reload.kind == Kind::Program)
+                glDeleteProgram(reload.object);
+            else
+                glDeleteTextures(1, &reload.object);
+        }
+        ready.clear();
+        if (context)
+        {
+            glfwDestroyWindow(context);
+            context = nullptr;
+        }
+    }
+
+    // Targets must be registered before start() and stay alive until stop() returns.
+    void watchShader(Shader& shader) { shaders.push_back(&shader); }
+    void watchTexture(const std::string& path, GLuint& texture)
+    {
+        textures.push_back({std::string{normalizeAssetPath(path)}, &texture});
+    }
+
+    void start(const std::vector<std::string>& directories)
+    {
+#ifdef __linux__
+        if (!context)
+        {
+            return;
+        }
+
+        fd = inotify_init1(IN_NONBLOCK);
+        if (fd < 0)
+        {
+            std::cout << "WARNING::ASSET_WATCHER::INOTIFY_INIT_FAILED, hot reload disabled" << std::endl;
+            return;
+        }
+        for (const auto& dir : directories)
+        {
+            // Editors often save through a rename, so IN_MOVED_TO matters as much as IN_CLOSE_WRITE
+            int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0)
+            {
+                watches.push_back({wd, std::string{normalizeAssetPath(dir)}});
+            }
+        }
+
+        running = true;
+        worker = std::thread(&AssetWatcher::run, this);
+#else
+        (void)directories;
+#endif
+    }
+
+    // Swap in every object the worker finished since the last call. Call once per frame on the GL thread,
+    // returns the time spent so callers can attribute it to the frame.
+    float apply()
+    {
+        std::vector<Reload> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ready.empty())
+            {
+                return 0.0f;
+            }
+            finished.swap(ready);
+        }
+
+        const auto begin = clock::now();
+        for (const auto& reload : finished)
+        {
+            if (reload.kind == Kind::Program)
+            {
+                shaders[reload.target]->swapProgram(reload.object);
+            }
+            else
+            {
+                GLuint& texture = *textures[reload.target].texture;
+                glState.forgetTexture(texture);
+                glDeleteTextures(1, &texture);
+                texture = reload.object;
+            }
+        }
+        const auto end = clock::now();
+        const float swapMs = std::chrono::duration<float, std::milli>(end - begin).count();
+
+        for (const auto& reload : finished)
+        {
+            const float latencyMs = std::chrono::duration<float, std::milli>(end - reload.detected).count();
+            const float buildMs = std::chrono::duration<float, std::milli>(reload.built - reload.detected).count();
+            std::cout << "reloaded " << reload.path << ": " << latencyMs << " ms from change to swap (" << buildMs
+                      << " ms off-thread), " << swapMs << " ms on the frame" << std::endl;
+        }
+        return swapMs;
+    }
+
+private:
+    enum class Kind
+    {
+        Program,
+        Texture
+    };
+
+    struct TextureTarget
+    {
+        std::string path;
+        GLuint* texture;
+    };
+
+    struct Watch
+    {
+        int wd;
+        std::string dir;
+    };
+
+    struct Reload
+    {
+        Kind kind;
+        size_t target;
+        GLuint object;
+        std::string path;
+        clock::time_point detected;
+        clock::time_point built;
+    };
+
+#ifdef __linux__
+    void run()
+    {
+        glfwMakeContextCurrent(context);
+
+        alignas(inotify_event) char buffer[4096];
+        std::vector<std::string> changed;
+
+        while (running)
+        {
+            pollfd pfd{fd, POLLIN, 0};
+            if (poll(&pfd, 1, 100) <= 0)
+            {
+                continue;
+            }
+
+            const auto detected = clock::now();
+            changed.clear();
+
+            // A single save usually fires several events, give the editor a moment and coalesce them
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            ssize_t len;
+            while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* ptr = buffer; ptr < buffer + len;)
+                {
+                    const auto* event = reinterpret_cast<const inotify_event*>(ptr);
+                    ptr += sizeof(inotify_event) + event->len;
+                    if (!event->len)
+                    {
+                        continue;
+                    }
+                    for (const auto& watch : watches)
+                    {
+                        if (watch.wd != event->wd)
+                        {
+                            continue;
+                        }
+                        auto path = watch.dir == "." ? std::string{event->name} : watch.dir + "/" + event->name;
+                        bool seen = false;
+                        for (const auto& p : changed)
+                            seen = seen || p == path;
+                        if (!seen)
+                            changed.push_back(path);
+                    }
+                }
+            }
+
+            for (const auto& path : changed)
+            {
+                rebuild(path, detected);
+            }
+        }
+
+        glfwMakeContextCurrent(nullptr);
+        close(fd);
+    }
+#endif
+
+    static bool includes(const Shader& shader, const std::string& path)
+    {
+        for (const auto& included : shader.includePaths)
+        {
+            if (normalizeAssetPath(included) == path)
+                return true;
+        }
+        return false;
+    }
+
+    void rebuild(const std::string& path, clock::time_point detected)
+    {
+        std::vector<Reload> built;
+
+        for (size_t i = 0; i < shaders.size(); i++)
+        {
+            const auto* shader = shaders[i];
+            unsigned int program = 0;
+            if (!shader->computePath.empty())
+            {
+                if (normalizeAssetPath(shader->computePath) != path && !includes(*shader, path))
+                {
+                    continue;
+                }
+                auto computeCode = readAssetFromDisk(shader->computePath);
+                program = computeCode ? Shader::compileCompute(
+                                            Shader::expandIncludes(computeCode.text(), readAssetFromDisk))
+                                      : 0;
+            }
+            else
+            {
+                if (normalizeAssetPath(shader->vertexPath) != path &&
+                    normalizeAssetPath(shader->fragmentPath) != path && !includes(*shader, path))
+                {
+                    continue;
+                }
+                // Always from disk, the embedded copy is what we are replacing
+                auto vertexCode = readAssetFromDisk(shader->vertexPath);
+                auto fragmentCode = readAssetFromDisk(shader->fragmentPath);
+                program = vertexCode && fragmentCode
+                              ? Shader::compile(Shader::expandIncludes(vertexCode.text(), readAssetFromDisk),
+                                                Shader::expandIncludes(fragmentCode.text(), readAssetFromDisk))
+                              : 0;
+            }
+            if (!program)
+            {
+                std::cout << "reload of " << path << " failed, keeping the previous program" << std::endl;
+                continue;
+            }
+            built.push_back({Kind::Program, i, program, path, detected, {}});
+        }
+
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            if (textures[i].path != path)
+            {
+                continue;
+            }
+            auto texture = loadTexture(readAssetFromDisk(path), path);
+            if (!texture)
+            {
+                std::cout << "reload of " << path << " failed, keeping the previous texture" << std::endl;
+                continue;
+            }
+            built.push_back({Kind::Texture, i, texture, path, detected, {}});
+        }
+
+        if (built.empty())
+        {
+            return;
+        }
+
+        // The main context may only see the new objects once the commands creating them have completed
+        auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+
+        const auto now = clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& reload : built)
+        {
+            reload.built = now;
+            ready.push_back(reload);
+        }
+    }
+
+    GLFWwindow* context = nullptr;
+    std::vector<Shader*> shaders;
+    std::vector<TextureTarget> textures;
+    std::vector<Watch> watches;
+    int fd = -1;
+
+    std::atomic<bool> running{false};
+    std::thread worker;
+
+    std::mutex mutex;
+    std::vector<Reload> ready;
+};
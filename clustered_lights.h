@@ -0,0 +1,335 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "culling.h"
+#include "gl_state.h"
+#include "math.h"
+#include "shader.h"
+#include "thread_pool.h"
+
+struct ClusterStats
+{
+    unsigned long lights = 0;
+    unsigned long indices = 0;
+    unsigned long overflows = 0;
+    double assignMs = 0.0;
+};
+
+inline ClusterStats clusterStats;
+
+struct PointLight
+{
+    vec3 position;
+    float radius;
+    vec3 color;
+};
+
+// Corridor lights drifting around their spawn point, the scene has no other light sources.
+class LightField
+{
+public:
+    // Scatter count lights through the areas, the same count always gives the same lights
+    void spawn(int count, const std::vector<Bounds>& areas)
+    {
+        if (areas.empty())
+            count = 0;
+        lights.resize(count);
+        anchors.resize(count);
+        phases.resize(count);
+
+        uint32_t seed = 0x9E3779B9u;
+        const auto random = [&seed]
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+        };
+        for (int i = 0; i < count; i++)
+        {
+            const auto& area = areas[std::min(static_cast<size_t>(random() * areas.size()), areas.size() - 1)];
+            anchors[i] = area.center + vec3{(random() * 2.0f - 1.0f) * area.extents.x,
+                                            (random() * 2.0f - 1.0f) * area.extents.y,
+                                            (random() * 2.0f - 1.0f) * area.extents.z};
+            phases[i] = random() * 6.2831853f;
+            lights[i].radius = 1.0f + random() * 1.5f;
+            lights[i].color = vec3{0.2f + random(), 0.2f + random(), 0.2f + random()} * 0.6f;
+        }
+    }
+
+    void animate(float time)
+    {
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const float t = time + phases[i];
+            lights[i].position = anchors[i] + vec3{std::sin(t * 0.7f) * 0.5f, std::sin(t * 1.3f) * 0.3f,
+                                                   std::cos(t * 0.5f) * 1.5f};
+        }
+    }
+
+    const std::vector<PointLight>& all() const { return lights; }
+
+private:
+    std::vector<PointLight> lights;
+    std::vector<vec3> anchors;
+    std::vector<float> phases;
+};
+
+// Clustered forward shading. The view frustum is cut into tilesX x tilesY screen tiles and slices depth slices,
+// spaced exponentially so clusters stay roughly cube shaped along the corridor. Every frame each light's sphere is
+// tested against the clusters it can touch, one ThreadPool job per slice, and the result goes to the GPU as
+// texture buffers: the lights in view space, an (offset, count) pair per cluster and the concatenated light
+// indices. The fragment shader finds its cluster from gl_FragCoord and its view depth and only loops over the
+// lights listed there.
+//
+// Texture buffers keep this on GL 3.3, storage buffers would need 4.3. The index list is capped at what the driver
+// supports for a texture buffer, clusters past the cap lose lights rather than the frame failing.
+class ClusteredLights
+{
+public:
+    static constexpr int tilesX = 16;
+    static constexpr int tilesY = 9;
+    static constexpr int slices = 24;
+    static constexpr int clusterCount = tilesX * tilesY * slices;
+
+    // Texture units the lighting samplers use, units 0 and 1 belong to the materials
+    static constexpr GLuint lightUnit = 2;
+    static constexpr GLuint clusterUnit = 3;
+    static constexpr GLuint indexUnit = 4;
+
+    ClusteredLights(ThreadPool& pool) : pool(pool), sliceLists(slices)
+    {
+        for (auto& lists : sliceLists)
+            lists.resize(tilesX * tilesY);
+
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        maxIndices = std::min<size_t>(std::max(maxTexels, 65536), maxIndexCap);
+
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i = 0; i < 3; i++)
+        {
+            glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]);
+            glBufferData(GL_COPY_WRITE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glState.bindTexture(lightUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+    }
+
+    ~ClusteredLights()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            glState.forgetBuffer(buffers[i]);
+            glState.bindTexture(lightUnit + i, GL_TEXTURE_BUFFER, 0);
+        }
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+    }
+
+    ClusteredLights(const ClusteredLights&) = delete;
+    ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+    // Assign the lights to clusters and upload the result. proj must come from perspective(), view from lookAt().
+    // A sub-pixel jitter in proj is taken out again in the shader, the tiles stay on the unjittered screen.
+    // shadowSlots holds each light's ShadowAtlas slot, empty when nothing casts shadows.
+    void update(const std::vector<PointLight>& lights, const std::vector<int>& shadowSlots, const mat4& view,
+                const mat4& proj, float nearPlane, float farPlane, int width, int height)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+
+        zNear = nearPlane;
+        zFar = farPlane;
+        screenWidth = width;
+        screenHeight = height;
+        xScale = proj[0][0];
+        yScale = proj[1][1];
+        jitter = vec2{proj[2][0] * width * 0.5f, proj[2][1] * height * 0.5f};
+
+        viewLights.resize(lights.size());
+        lightTexels.resize(lights.size() * 2);
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const auto& light = lights[i];
+            const vec4 p = view * vec4{light.position.x, light.position.y, light.position.z, 1.0f};
+            viewLights[i] = {vec3{p.x, p.y, p.z}, light.radius, light.color};
+            lightTexels[i * 2] = vec4{p.x, p.y, p.z, light.radius};
+            const float slot = i < shadowSlots.size() ? static_cast<float>(shadowSlots[i]) : -1.0f;
+            lightTexels[i * 2 + 1] = vec4{light.color.x, light.color.y, light.color.z, slot};
+        }
+
+        pool.parallelFor(slices, [this](unsigned int slice) { assignSlice(slice); });
+
+        // Flatten the per-slice lists into one index buffer, cluster index = (slice * tilesY + y) * tilesX + x
+        clusterTable.resize(clusterCount * 2);
+        indices.clear();
+        bool overflow = false;
+        for (int slice = 0; slice < slices; slice++)
+        {
+            for (int tile = 0; tile < tilesX * tilesY; tile++)
+            {
+                const auto& list = sliceLists[slice][tile];
+                const size_t count = std::min(list.size(), maxIndices - indices.size());
+                overflow = overflow || count < list.size();
+                const int cluster = slice * tilesX * tilesY + tile;
+                clusterTable[cluster * 2] = static_cast<uint32_t>(indices.size());
+                clusterTable[cluster * 2 + 1] = static_cast<uint32_t>(count);
+                indices.insert(indices.end(), list.begin(), list.begin() + count);
+            }
+        }
+        if (overflow)
+        {
+            clusterStats.overflows++;
+            if (!warned)
+            {
+                std::cout << "WARNING::CLUSTERED_LIGHTS::INDEX_OVERFLOW " << maxIndices << " light indices"
+                          << std::endl;
+                warned = true;
+            }
+        }
+
+        upload(0, lightTexels.data(), lightTexels.size() * sizeof(vec4));
+        upload(1, clusterTable.data(), clusterTable.size() * sizeof(uint32_t));
+        upload(2, indices.data(), indices.size() * sizeof(uint32_t));
+
+        clusterStats.lights += lights.size();
+        clusterStats.indices += indices.size();
+        clusterStats.assignMs +=
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // Bind the buffers and set the uniforms a lit shader reads, see lighting.glsl
+    void apply(Shader& shader, bool lighting)
+    {
+        for (int i = 0; i < 3; i++)
+            glState.bindTexture(lightUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+
+        const float logRatio = std::log(zFar / zNear);
+        shader.setBool("lighting", lighting);
+        shader.setInt("lightData", lightUnit);
+        shader.setInt("clusterData", clusterUnit);
+        shader.setInt("lightIndices", indexUnit);
+        shader.setVec2("tileSize", vec2{static_cast<float>(screenWidth) / tilesX,
+                                        static_cast<float>(screenHeight) / tilesY});
+        shader.setVec2("tileJitter", jitter);
+        shader.setFloat("sliceScale", slices / logRatio);
+        shader.setFloat("sliceBias", -slices * std::log(zNear) / logRatio);
+    }
+
+private:
+    static constexpr size_t maxIndexCap = size_t{1} << 22;
+
+    // Depth where a slice starts, slice 0 starts at the near plane
+    float sliceDepth(int slice) const { return zNear * std::pow(zFar / zNear, static_cast<float>(slice) / slices); }
+
+    void assignSlice(unsigned int slice)
+    {
+        auto& lists = sliceLists[slice];
+        for (auto& list : lists)
+            list.clear();
+
+        const float sliceNear = sliceDepth(slice);
+        const float sliceFar = sliceDepth(slice + 1);
+
+        // View space box of every tile column and row over the slice's depth range. The sphere test is separable,
+        // dz is per light, dy per row and dx per column.
+        float minX[tilesX], maxX[tilesX], minY[tilesY], maxY[tilesY];
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            const float n0 = tx * 2.0f / tilesX - 1.0f;
+            const float n1 = (tx + 1) * 2.0f / tilesX - 1.0f;
+            minX[tx] = std::min(n0 * sliceNear, n0 * sliceFar) / xScale;
+            maxX[tx] = std::max(n1 * sliceNear, n1 * sliceFar) / xScale;
+        }
+        for (int ty = 0; ty < tilesY; ty++)
+        {
+            const float n0 = ty * 2.0f / tilesY - 1.0f;
+            const float n1 = (ty + 1) * 2.0f / tilesY - 1.0f;
+            minY[ty] = std::min(n0 * sliceNear, n0 * sliceFar) / yScale;
+            maxY[ty] = std::max(n1 * sliceNear, n1 * sliceFar) / yScale;
+        }
+
+        for (uint32_t i = 0; i < viewLights.size(); i++)
+        {
+            const auto& light = viewLights[i];
+            const vec3& c = light.position;
+            const float r = light.radius;
+            // View space looks down -z, depth is positive in front of the camera
+            const float depth = -c.z;
+            const float dMin = std::max(depth - r, sliceNear);
+            const float dMax = std::min(depth + r, sliceFar);
+            if (dMin > dMax)
+            {
+                continue;
+            }
+
+            // Screen extent of the sphere's box over the depth range it covers in this slice. x / depth is
+            // monotonic in depth, the extremes lie at either end of the range.
+            const float x0 = std::min((c.x - r) / dMin, (c.x - r) / dMax) * xScale;
+            const float x1 = std::max((c.x + r) / dMin, (c.x + r) / dMax) * xScale;
+            const float y0 = std::min((c.y - r) / dMin, (c.y - r) / dMax) * yScale;
+            const float y1 = std::max((c.y + r) / dMin, (c.y + r) / dMax) * yScale;
+            if (x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f)
+            {
+                continue;
+            }
+            const int tx0 = std::clamp(static_cast<int>((x0 * 0.5f + 0.5f) * tilesX), 0, tilesX - 1);
+            const int tx1 = std::clamp(static_cast<int>((x1 * 0.5f + 0.5f) * tilesX), 0, tilesX - 1);
+            const int ty0 = std::clamp(static_cast<int>((y0 * 0.5f + 0.5f) * tilesY), 0, tilesY - 1);
+            const int ty1 = std::clamp(static_cast<int>((y1 * 0.5f + 0.5f) * tilesY), 0, tilesY - 1);
+
+            const float dz = c.z - std::clamp(c.z, -sliceFar, -sliceNear);
+            const float r2 = r * r - dz * dz;
+            for (int ty = ty0; ty <= ty1; ty++)
+            {
+                const float dy = c.y - std::clamp(c.y, minY[ty], maxY[ty]);
+                const float rowR2 = r2 - dy * dy;
+                if (rowR2 < 0.0f)
+                {
+                    continue;
+                }
+                for (int tx = tx0; tx <= tx1; tx++)
+                {
+                    const float dx = c.x - std::clamp(c.x, minX[tx], maxX[tx]);
+                    if (dx * dx <= rowR2)
+                        lists[ty * tilesX + tx].push_back(i);
+                }
+            }
+        }
+    }
+
+    void upload(int buffer, const void* data, size_t bytes)
+    {
+        // Orphan, last frame's draws keep reading the old storage
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffers[buffer]);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+        if (bytes)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, bytes, data);
+    }
+
+    ThreadPool& pool;
+    std::vector<PointLight> viewLights;
+    std::vector<vec4> lightTexels;
+    std::vector<uint32_t> clusterTable;
+    std::vector<uint32_t> indices;
+    std::vector<std::vector<std::vector<uint32_t>>> sliceLists;
+    size_t maxIndices = 0;
+    GLuint buffers[3] = {};
+    GLuint textures[3] = {};
+    float zNear = 0.1f;
+    float zFar = 100.0f;
+    float xScale = 1.0f;
+    float yScale = 1.0f;
+    vec2 jitter;
+    int screenWidth = 1;
+    int screenHeight = 1;
+    bool warned = false;
+};
@@ -0,0 +1,33 @@
+# Generates a header holding every file in ASSETS as a constexpr byte array plus a lookup table keyed by the
+# path relative to ROOT. Invoked at build time through `cmake -P`, see the embedded_assets target.
+#
+# Inputs: ROOT, OUTPUT, ASSETS (list of absolute paths)
+
+set(content "// Generated by cmake/embed_assets.cmake, do not edit.\n#pragma once\n\n#include <cstddef>\n\n")
+string(APPEND content "struct EmbeddedAsset\n{\n    const char* path;\n    const unsigned char* data;\n    std::size_t size;\n};\n\n")
+
+set(table "")
+set(index 0)
+foreach(asset IN LISTS ASSETS)
+    file(RELATIVE_PATH name "${ROOT}" "${asset}")
+    file(READ "${asset}" hex HEX)
+    string(LENGTH "${hex}" hexLength)
+    math(EXPR size "${hexLength} / 2")
+    # 16 bytes per line keeps the generated file readable and the compiler happy
+    string(REGEX REPLACE "([0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f])" "\\1\n    " hex "${hex}")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    # Text assets are handed to GL as-is, a trailing zero makes them usable as C strings too
+    string(APPEND content "inline constexpr unsigned char embeddedAsset${index}[] = {\n    ${bytes}0x00};\n\n")
+    string(APPEND table "    {\"${name}\", embeddedAsset${index}, ${size}},\n")
+    math(EXPR index "${index} + 1")
+endforeach()
+
+string(APPEND content "inline constexpr EmbeddedAsset embeddedAssets[] = {\n${table}};\n")
+
+# Only touch the output when something changed so dependents are not rebuilt needlessly
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL content)
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gl_state.h"
+#include "math.h"
+#include "shader.h"
+
+// A stretch of draw submission recorded as plain data. Recording only appends to vectors the buffer owns, so
+// worker threads can each fill their own buffer at the same time; nothing reaches GL until replay() walks the
+// buffer on the GL thread. Commands are fixed 16 byte packets with their arguments inline, programs and model
+// matrices sit in side arrays the packets index into. Apart from replay() the format only carries object names and
+// enum values, another backend would bring its own replay.
+class CommandBuffer
+{
+public:
+    enum class Op : uint32_t
+    {
+        SetPassState,     // a: colour write | depth write << 1, b: depth function
+        BindProgram,      // a: index into programs
+        BindVertexArray,  // a: vertex array
+        BindTexture,      // a: unit, b: texture
+        SetModel,         // a: index into matrices, goes to the bound program's model uniform
+        Draw              // a: index count, b: instance count or 0, c: occlusion query to render on or 0
+    };
+
+    struct Command
+    {
+        Op op;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+    };
+
+    // Storage is kept, steady-state frames record without allocating
+    void clear()
+    {
+        commands.clear();
+        programs.clear();
+        matrices.clear();
+    }
+
+    void setPassState(bool colorWrite, bool depthWrite, GLenum depthFunc)
+    {
+        const uint32_t writes = static_cast<uint32_t>(colorWrite) | static_cast<uint32_t>(depthWrite) << 1;
+        commands.push_back({Op::SetPassState, writes, depthFunc, 0});
+    }
+
+    void bindProgram(Shader* shader)
+    {
+        commands.push_back({Op::BindProgram, static_cast<uint32_t>(programs.size()), 0, 0});
+        programs.push_back(shader);
+    }
+
+    void bindVertexArray(GLuint vertexArray) { commands.push_back({Op::BindVertexArray, vertexArray, 0, 0}); }
+
+    void bindTexture(GLuint unit, GLuint texture) { commands.push_back({Op::BindTexture, unit, texture, 0}); }
+
+    void setModel(const mat4& model)
+    {
+        commands.push_back({Op::SetModel, static_cast<uint32_t>(matrices.size()), 0, 0});
+        matrices.push_back(model);
+    }
+
+    void draw(GLsizei indexCount, GLsizei instanceCount, GLuint condition)
+    {
+        commands.push_back(
+            {Op::Draw, static_cast<uint32_t>(indexCount), static_cast<uint32_t>(instanceCount), condition});
+    }
+
+    size_t size() const { return commands.size(); }
+
+    // Issue the recorded commands, GL thread only. Binds go through the state cache, buffers recorded separately
+    // repeat the state the previous one left and the cache drops those.
+    void replay() const
+    {
+        Shader* program = nullptr;
+        Shader::UniformSlot model;
+        for (const auto& command : commands)
+        {
+            switch (command.op)
+            {
+            case Op::SetPassState:
+                glState.colorMask(command.a & 1);
+                glState.depthMask(command.a & 2);
+                glState.depthFunc(command.b);
+                break;
+            case Op::BindProgram:
+                program = programs[command.a];
+                program->use();
+                // Once per program change, the per-draw model upload then goes straight to the slot
+                model = program->uniform(modelName);
+                break;
+            case Op::BindVertexArray:
+                glState.bindVertexArray(command.a);
+                break;
+            case Op::BindTexture:
+                glState.bindTexture(command.a, GL_TEXTURE_2D, command.b);
+                break;
+            case Op::SetModel:
+                program->setMat4(model, matrices[command.a]);
+                break;
+            case Op::Draw:
+                // The GPU drops the draw if the query saw no samples, an unfinished query draws as usual
+                if (command.c)
+                    glBeginConditionalRender(command.c, GL_QUERY_NO_WAIT);
+                if (command.b)
+                    glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(command.a), GL_UNSIGNED_INT, 0,
+                                            static_cast<GLsizei>(command.b));
+                else
+                    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(command.a), GL_UNSIGNED_INT, 0);
+                if (command.c)
+                    glEndConditionalRender();
+                break;
+            }
+        }
+    }
+
+private:
+    static inline const std::string modelName{"model"};
+
+    std::vector<Command> commands;
+    std::vector<Shader*> programs;
+    std::vector<mat4> matrices;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "math.h"
+#include "mesh.h"
+#include "scene.h"
+
+// World-space bounds stored as center and half extents, which makes the plane test a pair of dot products.
+struct Bounds
+{
+    vec3 center;
+    vec3 extents;
+};
+
+// Bounds of a mesh after transforming it, computed from the transformed vertices.
+inline Bounds computeBounds(const std::vector<Vertex>& vertices, const mat4& model)
+{
+    vec3 lo{INFINITY};
+    vec3 hi{-INFINITY};
+    for (const auto& vertex : vertices)
+    {
+        const auto p = model * vec4{vertex.x, vertex.y, vertex.z, 1.0f};
+        lo = vec3{std::fmin(lo.x, p.x), std::fmin(lo.y, p.y), std::fmin(lo.z, p.z)};
+        hi = vec3{std::fmax(hi.x, p.x), std::fmax(hi.y, p.y), std::fmax(hi.z, p.z)};
+    }
+    return {(lo + hi) * 0.5f, (hi - lo) * 0.5f};
+}
+
+inline Bounds computeBounds(const std::vector<Vertex>& vertices)
+{
+    return computeBounds(vertices, mat4{1.0f});
+}
+
+// Bounds of every renderable in the scene, all of them are unit quads.
+inline std::vector<Bounds> computeSceneBounds(const std::vector<Renderable>& scene)
+{
+    std::vector<Bounds> bounds;
+    bounds.reserve(scene.size());
+    for (const auto& renderable : scene)
+    {
+        bounds.push_back(computeBounds(quadVertices, renderable.model));
+    }
+    return bounds;
+}
+
+// Six planes pointing inwards, (a, b, c, d) with a * x + b * y + c * z + d >= 0 inside.
+struct Frustum
+{
+    vec4 planes[6];
+};
+
+// Gribb/Hartmann extraction from a combined proj * view matrix.
+inline Frustum extractFrustum(const mat4& viewProj)
+{
+    const vec4 row0{viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]};
+    const vec4 row1{viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]};
+    const vec4 row2{viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]};
+    const vec4 row3{viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]};
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;  // left
+    frustum.planes[1] = row3 - row0;  // right
+    frustum.planes[2] = row3 + row1;  // bottom
+    frustum.planes[3] = row3 - row1;  // top
+    frustum.planes[4] = row3 + row2;  // near
+    frustum.planes[5] = row3 - row2;  // far
+    return frustum;
+}
+
+// Conservative: a box is only rejected when it lies fully outside one plane.
+inline bool isVisible(const vec4* planes, int planeCount, const Bounds& bounds)
+{
+    for (int i = 0; i < planeCount; i++)
+    {
+        const auto& plane = planes[i];
+        const float distance =
+            plane.x * bounds.center.x + plane.y * bounds.center.y + plane.z * bounds.center.z + plane.w;
+        const float radius = std::fabs(plane.x) * bounds.extents.x + std::fabs(plane.y) * bounds.extents.y +
+                             std::fabs(plane.z) * bounds.extents.z;
+        if (distance + radius < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool isVisible(const Frustum& frustum, const Bounds& bounds) { return isVisible(frustum.planes, 6, bounds); }
+
+struct CullingStats
+{
+    unsigned long tested = 0;
+    unsigned long visible = 0;
+    double ms = 0.0;
+};
+
+inline CullingStats cullingStats;
+
+// Append the indices of every visible bounds to visible, which is cleared first.
+inline void frustumCull(const Frustum& frustum, const std::vector<Bounds>& bounds, std::vector<unsigned int>& visible)
+{
+    const auto begin = std::chrono::steady_clock::now();
+    visible.clear();
+    for (unsigned int i = 0; i < bounds.size(); i++)
+    {
+        if (isVisible(frustum, bounds[i]))
+        {
+            visible.push_back(i);
+        }
+    }
+    cullingStats.tested += bounds.size();
+    cullingStats.visible += visible.size();
+    cullingStats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
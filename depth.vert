@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;
+
+// Must produce the exact depth rect.vert does, the shading pass tests against it with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = proj * view * model * vec4(aPos, 1.0);
+}
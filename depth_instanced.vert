@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel;
+
+uniform mat4 proj;
+uniform mat4 view;
+
+// Must produce the exact depth rect_instanced.vert does, the shading pass tests against it with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = proj * view * aModel * vec4(aPos, 1.0);
+}
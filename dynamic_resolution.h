@@ -0,0 +1,229 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "gl_state.h"
+#include "render_graph.h"
+#include "shader.h"
+
+struct ResolutionStats
+{
+    double scale = 0.0;
+    unsigned long pixels = 0;
+    unsigned long reallocations = 0;
+};
+
+inline ResolutionStats resolutionStats;
+
+// Picks the scene's resolution scale from the measured GPU frame time. Shading cost follows the pixel count, the
+// square of the scale, so the scale that would have met the target is scale * sqrt(target / measured). The
+// controller only moves a fraction of the way there each frame, timer results arrive a few frames late and
+// chasing them outright oscillates, and it aims under the budget so noise does not push frames over it. The
+// ceiling caps the scale, temporal upsampling lowers it since it reconstructs the full resolution anyway.
+class ResolutionController
+{
+public:
+    static constexpr float minScale = 0.5f;
+    static constexpr float maxScale = 1.0f;
+
+    explicit ResolutionController(float budgetMs = 16.0f) : budgetMs(budgetMs) {}
+
+    // Feed the latest GPU frame time, returns the scale to render the next frame at
+    float update(float gpuMs)
+    {
+        if (gpuMs <= 0.0f)
+        {
+            return applied;
+        }
+        const float desired = std::clamp(applied * std::sqrt(budgetMs * headroom / gpuMs), minScale, ceiling);
+        smoothed += (desired - smoothed) * response;
+
+        // Hold the applied scale inside a dead band so the render size is not nudged by a pixel every frame
+        if (std::fabs(smoothed - applied) >= step || (smoothed >= ceiling - step * 0.5f && applied != ceiling))
+        {
+            applied = std::clamp(std::round(smoothed / step) * step, minScale, ceiling);
+        }
+        return applied;
+    }
+
+    // Start over from the ceiling, the scale used while the controller is off
+    void reset()
+    {
+        smoothed = ceiling;
+        applied = ceiling;
+    }
+
+    void setCeiling(float scale)
+    {
+        ceiling = std::clamp(scale, minScale, maxScale);
+        smoothed = std::min(smoothed, ceiling);
+        applied = std::min(applied, ceiling);
+    }
+
+    float scale() const { return applied; }
+    float budget() const { return budgetMs; }
+
+private:
+    static constexpr float headroom = 0.9f;
+    static constexpr float response = 0.1f;
+    static constexpr float step = 0.025f;
+
+    float budgetMs;
+    float ceiling = maxScale;
+    float smoothed = maxScale;
+    float applied = maxScale;
+};
+
+// Offscreen colour and depth-stencil target the scene renders into at a fraction of the window size. The frame's
+// render graph imports both textures, addPresent() declares the upscale to the default framebuffer. The textures
+// are sized for the largest window seen so far and only ever grow: a smaller scale or window just renders into the
+// lower left corner of the same allocation, the upscale reads that corner back.
+class SceneTarget
+{
+public:
+    // Texture unit the upscale samples the scene from
+    static constexpr GLuint sceneUnit = 0;
+
+    SceneTarget()
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &colorTexture);
+        glGenTextures(1, &depthTexture);
+        glGenVertexArrays(1, &emptyVAO);
+        upscaleShader.setInt("scene", sceneUnit);
+    }
+
+    ~SceneTarget()
+    {
+        glState.forgetFramebuffer(framebuffer);
+        glState.forgetTexture(colorTexture);
+        glState.forgetTexture(depthTexture);
+        glState.forgetVertexArray(emptyVAO);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    SceneTarget(const SceneTarget&) = delete;
+    SceneTarget& operator=(const SceneTarget&) = delete;
+
+    Shader& shader() { return upscaleShader; }
+
+    // Size the frame for a window of width x height rendered at scale. Only reallocates when the window outgrows
+    // the textures.
+    void resize(int width, int height, float scale)
+    {
+        windowWidth = std::max(width, 1);
+        windowHeight = std::max(height, 1);
+        renderWidth = std::max(static_cast<int>(std::lround(windowWidth * scale)), 1);
+        renderHeight = std::max(static_cast<int>(std::lround(windowHeight * scale)), 1);
+
+        if (windowWidth > allocatedWidth || windowHeight > allocatedHeight)
+        {
+            allocate(std::max(windowWidth, allocatedWidth), std::max(windowHeight, allocatedHeight));
+        }
+        resolutionStats.scale += scale;
+        resolutionStats.pixels += static_cast<unsigned long>(renderWidth) * renderHeight;
+    }
+
+    // Bind the target with the viewport covering the rendered region
+    void bind()
+    {
+        glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glState.viewport(0, 0, renderWidth, renderHeight);
+    }
+
+    // Import the rendered region of the colour and depth-stencil textures into this frame's graph
+    RenderGraph::Resource importColor(RenderGraph& graph) const
+    {
+        return graph.importTexture("scene color", colorTexture, {renderWidth, renderHeight, GL_RGBA8}, allocatedWidth,
+                                   allocatedHeight);
+    }
+
+    RenderGraph::Resource importDepth(RenderGraph& graph) const
+    {
+        return graph.importTexture("scene depth", depthTexture, {renderWidth, renderHeight, GL_DEPTH24_STENCIL8},
+                                   allocatedWidth, allocatedHeight);
+    }
+
+    // Declare the upscale of color, the imported colour, to the whole of backbuffer. sharpness 0 is plain bilinear,
+    // higher values add an unsharp mask that wins back some of the detail lost to the lower resolution.
+    void addPresent(RenderGraph& graph, RenderGraph::Resource color, RenderGraph::Resource backbuffer,
+                    float sharpness)
+    {
+        graph.addPass("upscale", {color}, {backbuffer},
+                      [=](RenderGraph::Context& context)
+                      {
+                          context.bindTarget(backbuffer);
+                          glState.disable(GL_DEPTH_TEST);
+                          glState.colorMask(true);
+
+                          upscaleShader.setVec2("uvScale", context.uvScale(color));
+                          upscaleShader.setVec2("texelSize", vec2{1.0f / allocatedWidth, 1.0f / allocatedHeight});
+                          upscaleShader.setFloat("sharpness", renderWidth == windowWidth ? 0.0f : sharpness);
+                          upscaleShader.use();
+                          context.bindTexture(sceneUnit, color);
+                          glState.bindVertexArray(emptyVAO);
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+
+                          glState.enable(GL_DEPTH_TEST);
+                      });
+    }
+
+    int width() const { return renderWidth; }
+    int height() const { return renderHeight; }
+    // Size of the allocation the rendered region is a corner of
+    int textureWidth() const { return allocatedWidth; }
+    int textureHeight() const { return allocatedHeight; }
+    GLuint color() const { return colorTexture; }
+    GLuint depth() const { return depthTexture; }
+
+private:
+    void allocate(int width, int height)
+    {
+        allocatedWidth = width;
+        allocatedHeight = height;
+        resolutionStats.reallocations++;
+
+        glState.bindTexture(sceneUnit, GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // A texture rather than a renderbuffer so later passes can read the scene depth
+        glState.bindTexture(sceneUnit, GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL,
+                     GL_UNSIGNED_INT_24_8, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::SCENE_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+    }
+
+    Shader upscaleShader{"fullscreen.vert", "upscale.frag"};
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint depthTexture = 0;
+    GLuint emptyVAO = 0;
+    int allocatedWidth = 0;
+    int allocatedHeight = 0;
+    int windowWidth = 1;
+    int windowHeight = 1;
+    int renderWidth = 1;
+    int renderHeight = 1;
+};
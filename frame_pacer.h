@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+
+struct PacingStats
+{
+    unsigned long fenceWaits = 0;
+    double waitMs = 0.0;
+    unsigned long measured = 0;
+    double latencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
+inline PacingStats pacingStats;
+
+// Bounds how many frames the CPU queues ahead of the GPU. Every swap is followed by a fence, and before the next
+// frame starts the pacer waits until at most framesInFlight - 1 earlier frames are still unfinished. Left alone the
+// driver lets the CPU run several frames ahead, each of them sampled input that much earlier than it reaches the
+// screen. One frame in flight has the freshest input and the CPU and GPU take turns, three keep both busy.
+//
+// Latency is estimated per frame from when its input was sampled to when the GPU finished the frame, a GL_TIMESTAMP
+// counter next to the fence mapped onto the CPU clock. Scanout adds up to another refresh interval on top.
+class FramePacer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr int maxFramesInFlight = 3;
+
+    explicit FramePacer(int framesInFlight = 2)
+    {
+        setFramesInFlight(framesInFlight);
+        glGenQueries(maxFramesInFlight, queries);
+    }
+
+    ~FramePacer()
+    {
+        for (auto& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        glDeleteQueries(maxFramesInFlight, queries);
+    }
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    void setFramesInFlight(int frames) { depth = std::clamp(frames, 1, maxFramesInFlight); }
+    int framesInFlight() const { return depth; }
+
+    // When the input the current frame shows was sampled
+    void markInput(clock::time_point sampled) { inputTimes[frame % maxFramesInFlight] = sampled; }
+
+    // Right after the swap. Fences the frame, then waits until the next one may start.
+    void endFrame()
+    {
+        const int slot = frame % maxFramesInFlight;
+        // The slot's previous frame was waited for before this one started, its latency is already measured
+        if (fences[slot])
+            glDeleteSync(fences[slot]);
+        glQueryCounter(queries[slot], GL_TIMESTAMP);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pending[slot] = true;
+        frame++;
+
+        // Frames finish in order, waiting for the oldest one allowed to be unfinished covers everything before it
+        if (frame >= static_cast<unsigned long>(depth))
+        {
+            GLsync fence = fences[(frame - depth) % maxFramesInFlight];
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                const auto begin = clock::now();
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                pacingStats.fenceWaits++;
+                pacingStats.waitMs += std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+            }
+        }
+        measure();
+    }
+
+private:
+    // Latency of every finished frame not measured yet
+    void measure()
+    {
+        // The GPU clock has its own origin, sample both clocks together to map timestamps onto the CPU's
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        const auto cpuNow = clock::now();
+
+        for (int slot = 0; slot < maxFramesInFlight; slot++)
+        {
+            if (!pending[slot] || glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                continue;
+            }
+            GLuint64 finished = 0;
+            glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &finished);
+            pending[slot] = false;
+
+            const auto presented = cpuNow - std::chrono::nanoseconds(gpuNow - static_cast<GLint64>(finished));
+            const double latencyMs = std::chrono::duration<double, std::milli>(presented - inputTimes[slot]).count();
+            pacingStats.measured++;
+            pacingStats.latencyMs += latencyMs;
+            pacingStats.maxLatencyMs = std::max(pacingStats.maxLatencyMs, latencyMs);
+        }
+    }
+
+    int depth = 2;
+    unsigned long frame = 0;
+    GLsync fences[maxFramesInFlight] = {};
+    GLuint queries[maxFramesInFlight] = {};
+    bool pending[maxFramesInFlight] = {};
+    clock::time_point inputTimes[maxFramesInFlight];
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Feature checks and entry points for functionality newer than the GL 3.3 glad was generated for.
+
+inline bool glVersionAtLeast(int major, int minor)
+{
+    GLint actualMajor = 0, actualMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &actualMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &actualMinor);
+    return actualMajor > major || (actualMajor == major && actualMinor >= minor);
+}
+
+inline bool hasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const auto* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// GL 4.3 / ARB_ES3_compatibility
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+#define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A
+#endif
+
+// GL 4.2 / 4.3: compute shaders, shader storage buffers and indirect draws
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_DRAW_INDIRECT_BUFFER_BINDING 0x8F43
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#endif
+
+typedef void(APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint x, GLuint y, GLuint z);
+typedef void(APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void(APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect,
+                                                           GLsizei drawcount, GLsizei stride);
+typedef void(APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Optional entry points, null unless the matching feature flag is set.
+struct GLExtensions
+{
+    // GL 4.3: compute shaders, SSBOs and glMultiDrawElementsIndirect
+    bool computeAndIndirect = false;
+    PFNGLDISPATCHCOMPUTEPROC dispatchCompute = nullptr;
+    PFNGLMEMORYBARRIERPROC memoryBarrier = nullptr;
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect = nullptr;
+
+    // GL 4.4 or ARB_buffer_storage: immutable storage that can stay mapped while the GPU reads it
+    bool persistentMapping = false;
+    PFNGLBUFFERSTORAGEPROC bufferStorage = nullptr;
+};
+
+inline GLExtensions glExt;
+
+// Resolve everything glExt offers, call once after gladLoadGLLoader with the same loader.
+inline void loadGLExtensions(GLADloadproc load)
+{
+    if (glVersionAtLeast(4, 3))
+    {
+        glExt.dispatchCompute = reinterpret_cast<PFNGLDISPATCHCOMPUTEPROC>(load("glDispatchCompute"));
+        glExt.memoryBarrier = reinterpret_cast<PFNGLMEMORYBARRIERPROC>(load("glMemoryBarrier"));
+        glExt.multiDrawElementsIndirect =
+            reinterpret_cast<PFNGLMULTIDRAWELEMENTSINDIRECTPROC>(load("glMultiDrawElementsIndirect"));
+        glExt.computeAndIndirect = glExt.dispatchCompute && glExt.memoryBarrier && glExt.multiDrawElementsIndirect;
+    }
+    if (glVersionAtLeast(4, 4) || hasExtension("GL_ARB_buffer_storage"))
+    {
+        glExt.bufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(load("glBufferStorage"));
+        glExt.persistentMapping = glExt.bufferStorage != nullptr;
+    }
+}
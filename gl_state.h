@@ -0,0 +1,433 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "gl_ext.h"
+
+#include <iostream>
+
+// Shadow copy of the GL binding and fixed-function state of the main context. Every setter compares against the
+// cached value and only reaches the driver when something changes.
+//
+// Values start out unknown, so the first call always goes through. Code that changes state behind the cache's back
+// (loaders running before the frame loop, a deleted object that was bound) must call invalidate() or the matching
+// forget*() so a reused object name is not mistaken for the current binding. The debug mode re-reads everything
+// with glGet* once per frame and reports desyncs.
+class GLStateCache
+{
+public:
+    static const int textureUnits = 16;
+
+    struct Stats
+    {
+        unsigned long issued = 0;
+        unsigned long elided = 0;
+    };
+
+    // Cross-check the cache against glGet* once per frame
+    bool debug = false;
+    Stats stats;
+
+    GLStateCache() { invalidate(); }
+
+    void invalidate()
+    {
+        program = unknown;
+        drawFramebuffer = readFramebuffer = unknown;
+        vertexArray = unknown;
+        elementBuffer = unknown;
+        activeUnit = unknown;
+        for (auto& buffer : buffers)
+            buffer = unknown;
+        for (auto& unit : textures)
+            for (auto& texture : unit)
+                texture = unknown;
+        for (auto& sampler : samplers)
+            sampler = unknown;
+        for (auto& cap : caps)
+            cap = Tristate::Unknown;
+        blendSrc = blendDst = unknown;
+        depthFuncValue = unknown;
+        depthMaskValue = Tristate::Unknown;
+        colorMaskValue = Tristate::Unknown;
+        viewportValue[0] = viewportValue[1] = viewportValue[2] = viewportValue[3] = -1;
+    }
+
+    // Deleting an object unbinds it, its name may be handed out again by the next glGen*
+    void forgetProgram(GLuint id) { forget(program, id); }
+    void forgetVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+        {
+            vertexArray = unknown;
+            elementBuffer = unknown;
+        }
+    }
+    void forgetBuffer(GLuint id)
+    {
+        forget(elementBuffer, id);
+        for (auto& buffer : buffers)
+            forget(buffer, id);
+    }
+    void forgetFramebuffer(GLuint id)
+    {
+        forget(drawFramebuffer, id);
+        forget(readFramebuffer, id);
+    }
+    void forgetTexture(GLuint id)
+    {
+        for (auto& unit : textures)
+            for (auto& texture : unit)
+                forget(texture, id);
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (changed(program, id))
+            glUseProgram(id);
+    }
+    GLuint currentProgram() const { return program; }
+
+    // GL_FRAMEBUFFER binds both the draw and the read framebuffer
+    void bindFramebuffer(GLenum target, GLuint id)
+    {
+        const bool draw = target != GL_READ_FRAMEBUFFER && drawFramebuffer != id;
+        const bool read = target != GL_DRAW_FRAMEBUFFER && readFramebuffer != id;
+        if (!draw && !read)
+        {
+            stats.elided++;
+            return;
+        }
+        if (target == GL_FRAMEBUFFER && draw != read)
+            target = draw ? GL_DRAW_FRAMEBUFFER : GL_READ_FRAMEBUFFER;
+        if (draw)
+            drawFramebuffer = id;
+        if (read)
+            readFramebuffer = id;
+        glBindFramebuffer(target, id);
+        stats.issued++;
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (changed(vertexArray, id))
+        {
+            glBindVertexArray(id);
+            // The element buffer binding is part of the VAO
+            elementBuffer = unknown;
+        }
+    }
+
+    void bindBuffer(GLenum target, GLuint id)
+    {
+        if (target == GL_ELEMENT_ARRAY_BUFFER)
+        {
+            if (changed(elementBuffer, id))
+                glBindBuffer(target, id);
+            return;
+        }
+        const int slot = bufferSlot(target);
+        if (slot < 0)
+        {
+            glBindBuffer(target, id);
+            stats.issued++;
+            return;
+        }
+        if (changed(buffers[slot], id))
+            glBindBuffer(target, id);
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (changed(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        const int slot = textureSlot(target);
+        if (slot < 0 || unit >= textureUnits)
+        {
+            activeTexture(unit);
+            glBindTexture(target, id);
+            stats.issued++;
+            return;
+        }
+        if (textures[unit][slot] == id)
+        {
+            stats.elided++;
+            return;
+        }
+        activeTexture(unit);
+        textures[unit][slot] = id;
+        glBindTexture(target, id);
+        stats.issued++;
+    }
+
+    void bindSampler(GLuint unit, GLuint id)
+    {
+        if (unit >= textureUnits)
+        {
+            glBindSampler(unit, id);
+            stats.issued++;
+            return;
+        }
+        if (changed(samplers[unit], id))
+            glBindSampler(unit, id);
+    }
+
+    void enable(GLenum cap) { setCap(cap, true); }
+    void disable(GLenum cap) { setCap(cap, false); }
+
+    void blendFunc(GLenum src, GLenum dst)
+    {
+        if (blendSrc == src && blendDst == dst)
+        {
+            stats.elided++;
+            return;
+        }
+        blendSrc = src;
+        blendDst = dst;
+        glBlendFunc(src, dst);
+        stats.issued++;
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (changed(depthFuncValue, func))
+            glDepthFunc(func);
+    }
+
+    void depthMask(bool mask)
+    {
+        const auto value = mask ? Tristate::On : Tristate::Off;
+        if (depthMaskValue == value)
+        {
+            stats.elided++;
+            return;
+        }
+        depthMaskValue = value;
+        glDepthMask(mask ? GL_TRUE : GL_FALSE);
+        stats.issued++;
+    }
+
+    // All four channels together, nothing here writes a partial color mask
+    void colorMask(bool mask)
+    {
+        const auto value = mask ? Tristate::On : Tristate::Off;
+        if (colorMaskValue == value)
+        {
+            stats.elided++;
+            return;
+        }
+        colorMaskValue = value;
+        const GLboolean m = mask ? GL_TRUE : GL_FALSE;
+        glColorMask(m, m, m, m);
+        stats.issued++;
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        if (viewportValue[0] == x && viewportValue[1] == y && viewportValue[2] == width && viewportValue[3] == height)
+        {
+            stats.elided++;
+            return;
+        }
+        viewportValue[0] = x;
+        viewportValue[1] = y;
+        viewportValue[2] = width;
+        viewportValue[3] = height;
+        glViewport(x, y, width, height);
+        stats.issued++;
+    }
+
+    // Compare every known value with what the driver reports, returns the number of mismatches. Restores the
+    // active texture unit it has to walk through.
+    int validate()
+    {
+        int mismatches = 0;
+        auto check = [&](const char* name, GLuint cached, GLint actual)
+        {
+            if (cached != unknown && cached != static_cast<GLuint>(actual))
+            {
+                std::cout << "ERROR::GL_STATE::DESYNC " << name << ": cached " << cached << ", actual " << actual
+                          << std::endl;
+                mismatches++;
+            }
+        };
+        auto get = [](GLenum pname)
+        {
+            GLint value = 0;
+            glGetIntegerv(pname, &value);
+            return value;
+        };
+
+        check("program", program, get(GL_CURRENT_PROGRAM));
+        check("draw framebuffer", drawFramebuffer, get(GL_DRAW_FRAMEBUFFER_BINDING));
+        check("read framebuffer", readFramebuffer, get(GL_READ_FRAMEBUFFER_BINDING));
+        check("vertex array", vertexArray, get(GL_VERTEX_ARRAY_BINDING));
+        check("element buffer", elementBuffer, get(GL_ELEMENT_ARRAY_BUFFER_BINDING));
+        for (int slot = 0; slot < bufferTargetCount; slot++)
+        {
+            // Not a valid query on a plain 3.3 context, nothing binds it there anyway
+            if (bufferTargets[slot].target == GL_DRAW_INDIRECT_BUFFER && !glExt.computeAndIndirect)
+                continue;
+            check("buffer", buffers[slot], get(bufferTargets[slot].query));
+        }
+
+        const GLint previousUnit = get(GL_ACTIVE_TEXTURE) - GL_TEXTURE0;
+        check("active texture", activeUnit, previousUnit);
+        for (GLuint unit = 0; unit < textureUnits; unit++)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            for (int slot = 0; slot < textureTargetCount; slot++)
+                check("texture", textures[unit][slot], get(textureTargets[slot].query));
+            check("sampler", samplers[unit], get(GL_SAMPLER_BINDING));
+        }
+        glActiveTexture(GL_TEXTURE0 + previousUnit);
+
+        for (int slot = 0; slot < capCount; slot++)
+        {
+            if (caps[slot] != Tristate::Unknown)
+                check("capability", caps[slot] == Tristate::On, glIsEnabled(capList[slot]));
+        }
+        check("blend src", blendSrc, get(GL_BLEND_SRC_RGB));
+        check("blend dst", blendDst, get(GL_BLEND_DST_RGB));
+        check("depth func", depthFuncValue, get(GL_DEPTH_FUNC));
+        if (depthMaskValue != Tristate::Unknown)
+            check("depth mask", depthMaskValue == Tristate::On, get(GL_DEPTH_WRITEMASK));
+        if (colorMaskValue != Tristate::Unknown)
+        {
+            GLboolean actual[4];
+            glGetBooleanv(GL_COLOR_WRITEMASK, actual);
+            check("color mask", colorMaskValue == Tristate::On, actual[0]);
+        }
+
+        GLint actualViewport[4];
+        glGetIntegerv(GL_VIEWPORT, actualViewport);
+        if (viewportValue[2] >= 0)
+        {
+            for (int i = 0; i < 4; i++)
+                check("viewport", viewportValue[i], actualViewport[i]);
+        }
+        return mismatches;
+    }
+
+private:
+    enum class Tristate
+    {
+        Unknown,
+        Off,
+        On
+    };
+
+    struct Target
+    {
+        GLenum target;
+        GLenum query;
+    };
+
+    static constexpr GLuint unknown = ~0u;
+
+    static constexpr Target bufferTargets[] = {
+        {GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING},
+        {GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING},
+        // The target itself queries the bound buffer (GL_TEXTURE_BUFFER_BINDING in later headers),
+        // GL_TEXTURE_BINDING_BUFFER would be the unit's buffer texture
+        {GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER},
+        {GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER},
+        {GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER},
+        {GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING},
+        {GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER_BINDING},
+    };
+    static constexpr int bufferTargetCount = sizeof(bufferTargets) / sizeof(bufferTargets[0]);
+
+    static constexpr Target textureTargets[] = {
+        {GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D},
+        {GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY},
+        {GL_TEXTURE_BUFFER, GL_TEXTURE_BINDING_BUFFER},
+        {GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP},
+    };
+    static constexpr int textureTargetCount = sizeof(textureTargets) / sizeof(textureTargets[0]);
+
+    static constexpr GLenum capList[] = {GL_DEPTH_TEST, GL_BLEND,        GL_CULL_FACE,
+                                         GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_POLYGON_OFFSET_FILL};
+    static constexpr int capCount = sizeof(capList) / sizeof(capList[0]);
+
+    static int bufferSlot(GLenum target)
+    {
+        for (int slot = 0; slot < bufferTargetCount; slot++)
+            if (bufferTargets[slot].target == target)
+                return slot;
+        return -1;
+    }
+
+    static int textureSlot(GLenum target)
+    {
+        for (int slot = 0; slot < textureTargetCount; slot++)
+            if (textureTargets[slot].target == target)
+                return slot;
+        return -1;
+    }
+
+    // Store the new value and count the call, returns whether the driver has to be told
+    bool changed(GLuint& cached, GLuint value)
+    {
+        if (cached == value)
+        {
+            stats.elided++;
+            return false;
+        }
+        cached = value;
+        stats.issued++;
+        return true;
+    }
+
+    static void forget(GLuint& cached, GLuint id)
+    {
+        if (cached == id)
+            cached = unknown;
+    }
+
+    void setCap(GLenum cap, bool on)
+    {
+        int slot = -1;
+        for (int i = 0; i < capCount; i++)
+            if (capList[i] == cap)
+                slot = i;
+
+        const auto value = on ? Tristate::On : Tristate::Off;
+        if (slot >= 0 && caps[slot] == value)
+        {
+            stats.elided++;
+            return;
+        }
+        if (slot >= 0)
+            caps[slot] = value;
+        if (on)
+            glEnable(cap);
+        else
+            glDisable(cap);
+        stats.issued++;
+    }
+
+    GLuint program;
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+    GLuint vertexArray;
+    GLuint elementBuffer;
+    GLuint activeUnit;
+    GLuint buffers[bufferTargetCount];
+    GLuint textures[textureUnits][textureTargetCount];
+    GLuint samplers[textureUnits];
+    Tristate caps[capCount];
+    GLuint blendSrc;
+    GLuint blendDst;
+    GLuint depthFuncValue;
+    Tristate depthMaskValue;
+    Tristate colorMaskValue;
+    GLint viewportValue[4];
+};
+
+// The main context's state. Only the GL thread may touch it, other contexts keep their own state.
+inline GLStateCache glState;
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "culling.h"
+#include "gl_ext.h"
+#include "gl_state.h"
+#include "math.h"
+#include "mesh.h"
+#include "scene.h"
+#include "shader.h"
+
+// Layout of glMultiDrawElementsIndirect's commands.
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// std430 mirror of Object in cull.comp and rect_indirect.vert.
+struct GpuObject
+{
+    mat4 model;
+    vec4 center;  // w holds the material
+    vec4 extents;
+};
+
+static_assert(sizeof(GpuObject) == 96, "GpuObject must match the std430 layout of Object");
+
+// GPU-driven submission, needs GL 4.3. Transforms and bounds live in a shader storage buffer, cull.comp tests every
+// object against the frustum and appends survivors to their material's range of an index buffer, counting them in
+// that material's indirect command. One glMultiDrawElementsIndirect then draws everything, each command's
+// baseInstance points the per-instance object index attribute at its range.
+//
+// The CPU only resets the commands, sets the planes and issues a dispatch and a draw, so its cost stays the same
+// however many objects the scene holds.
+class GpuDrivenRenderer
+{
+public:
+    struct Stats
+    {
+        unsigned long objects = 0;
+        unsigned long dispatches = 0;
+        unsigned long multiDraws = 0;
+    };
+
+    static bool supported() { return glExt.computeAndIndirect; }
+
+    GpuDrivenRenderer(const Mesh& mesh, const std::vector<Renderable>& scene, const std::vector<Bounds>& bounds)
+        : objectCount(static_cast<GLsizei>(scene.size()))
+    {
+        std::vector<GpuObject> objects;
+        objects.reserve(scene.size());
+        GLuint perMaterial[MaterialCount] = {};
+        for (size_t i = 0; i < scene.size(); i++)
+        {
+            const auto& b = bounds[i];
+            objects.push_back({scene[i].model, vec4{b.center.x, b.center.y, b.center.z, float(scene[i].material)},
+                               vec4{b.extents.x, b.extents.y, b.extents.z, 0.0f}});
+            perMaterial[scene[i].material]++;
+        }
+
+        // One command per material, each owning a contiguous range of the visible index buffer
+        GLuint first = 0;
+        for (unsigned int material = 0; material < MaterialCount; material++)
+        {
+            commands[material] = {static_cast<GLuint>(mesh.indexCount), 0, 0, 0, first};
+            first += perMaterial[material];
+        }
+
+        glGenBuffers(1, &objectBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &visibleBuffer);
+
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, objectBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, objects.size() * sizeof(GpuObject), objects.data(), GL_STATIC_DRAW);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(commands), commands, GL_DYNAMIC_DRAW);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, visibleBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(scene.size(), 1) * sizeof(GLuint), nullptr,
+                     GL_DYNAMIC_COPY);
+
+        // The mesh's vertices plus the object index, one per instance
+        glGenVertexArrays(1, &VAO);
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+        setupVertexAttributes();
+        glState.bindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glEnableVertexAttribArray(2);
+        glVertexAttribDivisor(2, 1);
+        glState.bindVertexArray(0);
+
+        drawShader.setInt("textures[0]", 0);
+        drawShader.setInt("textures[1]", 1);
+    }
+
+    ~GpuDrivenRenderer()
+    {
+        for (auto buffer : {objectBuffer, commandBuffer, visibleBuffer})
+            glState.forgetBuffer(buffer);
+        glState.forgetVertexArray(VAO);
+        glDeleteBuffers(1, &objectBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &visibleBuffer);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    GpuDrivenRenderer(const GpuDrivenRenderer&) = delete;
+    GpuDrivenRenderer& operator=(const GpuDrivenRenderer&) = delete;
+
+    Shader& cullProgram() { return cullShader; }
+    Shader& drawProgram() { return drawShader; }
+
+    // Cull on the GPU and draw the survivors. textures holds one texture per material.
+    void draw(const Frustum& frustum, bool frustumCulling, const mat4& view, const mat4& proj,
+              const GLuint* textures)
+    {
+        // Zero the instance counts, the rest of each command never changes
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(commands), commands);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleBuffer);
+
+        static const char* const planeNames[6] = {"planes[0]", "planes[1]", "planes[2]",
+                                                  "planes[3]", "planes[4]", "planes[5]"};
+        for (int i = 0; i < 6; i++)
+            cullShader.setVec4(planeNames[i], frustum.planes[i]);
+        cullShader.setInt("objectCount", objectCount);
+        cullShader.setBool("frustumCulling", frustumCulling);
+        cullShader.use();
+        glExt.dispatchCompute((objectCount + groupSize - 1) / groupSize, 1, 1);
+
+        // The draw reads the commands and the index attribute the dispatch wrote
+        glExt.memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        drawShader.setMat4("view", view);
+        drawShader.setMat4("proj", proj);
+        drawShader.use();
+        for (unsigned int material = 0; material < MaterialCount; material++)
+            glState.bindTexture(material, GL_TEXTURE_2D, textures[material]);
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glExt.multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, MaterialCount, 0);
+
+        stats.objects += objectCount;
+        stats.dispatches++;
+        stats.multiDraws++;
+    }
+
+    // Counters summed since the caller last reset them
+    Stats stats;
+
+private:
+    static constexpr GLsizei groupSize = 64;
+
+    Shader cullShader{"cull.comp"};
+    Shader drawShader{"rect_indirect.vert", "rect_indirect.frag"};
+    DrawElementsIndirectCommand commands[MaterialCount];
+    GLsizei objectCount;
+    GLuint objectBuffer = 0;
+    GLuint commandBuffer = 0;
+    GLuint visibleBuffer = 0;
+    GLuint VAO = 0;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries. Results are read a few frames late
+// from a small ring of queries so the CPU never waits on the GPU. Time-elapsed queries cannot nest.
+class GpuTimer
+{
+public:
+    GpuTimer() { glGenQueries(queryCount, queries); }
+    ~GpuTimer() { glDeleteQueries(queryCount, queries); }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin()
+    {
+        const int index = frame % queryCount;
+        if (frame >= queryCount)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &ns);
+                last = static_cast<float>(ns) / 1e6f;
+                measured = true;
+            }
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[index]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        frame++;
+    }
+
+    // Most recent completed measurement in milliseconds
+    float lastMs() const { return last; }
+    bool hasResult() const { return measured; }
+
+private:
+    static const int queryCount = 4;
+    GLuint queries[queryCount];
+    int frame = 0;
+    float last = 0.0f;
+    bool measured = false;
+};
+
+// Splits a stretch of GPU work into passes with GL_TIMESTAMP counters, one at the start and one after every pass.
+// Timestamps do not nest like time-elapsed queries, so this can run inside a GpuTimer. Read back from the same kind
+// of ring a few frames late. Every pass has to be marked every frame, in order, skipped ones just measure zero.
+class GpuPassTimer
+{
+public:
+    static constexpr int maxPasses = 8;
+
+    explicit GpuPassTimer(int passes) : passCount(passes < maxPasses ? passes : maxPasses)
+    {
+        glGenQueries(queryCount * (maxPasses + 1), &queries[0][0]);
+    }
+    ~GpuPassTimer() { glDeleteQueries(queryCount * (maxPasses + 1), &queries[0][0]); }
+
+    GpuPassTimer(const GpuPassTimer&) = delete;
+    GpuPassTimer& operator=(const GpuPassTimer&) = delete;
+
+    void begin()
+    {
+        const int index = frame % queryCount;
+        if (frame >= queryCount)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[index][passCount], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                // The last counter landed, so did every earlier one
+                GLuint64 stamps[maxPasses + 1] = {};
+                for (int i = 0; i <= passCount; i++)
+                    glGetQueryObjectui64v(queries[index][i], GL_QUERY_RESULT, &stamps[i]);
+                for (int i = 0; i < passCount; i++)
+                    last[i] = static_cast<float>(stamps[i + 1] - stamps[i]) / 1e6f;
+            }
+        }
+        glQueryCounter(queries[index][0], GL_TIMESTAMP);
+    }
+
+    // Call after pass has been issued
+    void mark(int pass) { glQueryCounter(queries[frame % queryCount][pass + 1], GL_TIMESTAMP); }
+
+    void end() { frame++; }
+
+    // Most recent completed measurement of a pass in milliseconds
+    float lastMs(int pass) const { return last[pass]; }
+
+private:
+    static const int queryCount = 4;
+    GLuint queries[queryCount][maxPasses + 1];
+    int passCount;
+    int frame = 0;
+    float last[maxPasses] = {};
+};
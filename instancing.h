@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "gl_state.h"
+#include "math.h"
+#include "mesh.h"
+#include "scene.h"
+
+// Per-instance attributes read by rect_instanced.vert, the model matrix takes locations 2-5.
+struct InstanceData
+{
+    mat4 model;
+    unsigned int material;
+};
+
+// Draws many copies of one mesh with a single glDrawElementsInstanced. Owns a VAO that reads the mesh vertices
+// per vertex and an instance buffer per instance, so the mesh's own VAO is left untouched.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer(const Mesh& mesh) : indexCount(mesh.indexCount)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &instanceVBO);
+
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+        setupVertexAttributes();
+
+        for (int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(2 + i);
+            glVertexAttribDivisor(2 + i, 1);
+        }
+        glEnableVertexAttribArray(6);
+        glVertexAttribDivisor(6, 1);
+        pointInstanceAttributes(instanceVBO, 0);
+
+        glState.bindVertexArray(0);
+    }
+
+    ~InstanceBuffer()
+    {
+        glState.forgetBuffer(instanceVBO);
+        glState.forgetVertexArray(VAO);
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Replace the instance data. Static scenery uploads once at level load.
+    void upload(const std::vector<InstanceData>& instances, GLenum usage = GL_STATIC_DRAW)
+    {
+        instanceCount = static_cast<GLsizei>(instances.size());
+        glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), usage);
+        if (source != instanceVBO || sourceOffset != 0)
+        {
+            glState.bindVertexArray(VAO);
+            pointInstanceAttributes(instanceVBO, 0);
+        }
+    }
+
+    // Read count instances from someone else's buffer, such as a per-frame stream buffer range. Only the attribute
+    // pointers of the VAO change, nothing is copied.
+    void useInstances(GLuint buffer, GLintptr offset, GLsizei count)
+    {
+        instanceCount = count;
+        if (source != buffer || sourceOffset != offset)
+        {
+            glState.bindVertexArray(VAO);
+            pointInstanceAttributes(buffer, offset);
+        }
+    }
+
+    void draw() const
+    {
+        if (!instanceCount)
+        {
+            return;
+        }
+        glState.bindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instanceCount);
+    }
+
+    GLsizei count() const { return instanceCount; }
+    GLsizei indices() const { return indexCount; }
+    GLuint vertexArray() const { return VAO; }
+
+private:
+    // Attributes 2-6 of the bound VAO at the instances starting at offset in buffer
+    void pointInstanceAttributes(GLuint buffer, GLintptr offset)
+    {
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (int i = 0; i < 4; i++)
+        {
+            glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (void*)(offset + offsetof(InstanceData, model) + i * sizeof(vec4)));
+        }
+        glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, sizeof(InstanceData),
+                               (void*)(offset + offsetof(InstanceData, material)));
+        source = buffer;
+        sourceOffset = offset;
+    }
+
+    GLuint VAO = 0;
+    GLuint instanceVBO = 0;
+    GLuint source = 0;
+    GLintptr sourceOffset = 0;
+    GLsizei indexCount = 0;
+    GLsizei instanceCount = 0;
+};
+
+// Instances of the scene grouped by material, one draw per group.
+inline std::vector<std::vector<InstanceData>> groupInstances(const std::vector<Renderable>& scene)
+{
+    std::vector<std::vector<InstanceData>> groups(MaterialCount);
+    for (const auto& renderable : scene)
+    {
+        groups[renderable.material].push_back({renderable.model, renderable.material});
+    }
+    return groups;
+}
@@ -0,0 +1,95 @@
+// Clustered point lighting and cube shadows shared by the lit fragment shaders, spliced in with #include after the
+// includer declares ViewPos. shade() lights an albedo; the uniforms are set by ClusteredLights and ShadowAtlas.
+
+// Clustered point lights, filled by ClusteredLights. Lights are in view space, two texels each.
+uniform bool lighting;
+uniform samplerBuffer lightData;     // position.xyz radius, color.rgb
+uniform usamplerBuffer clusterData;  // offset and count into lightIndices per cluster
+uniform usamplerBuffer lightIndices;
+uniform vec2 tileSize;
+uniform vec2 tileJitter;             // projection jitter in pixels, the tiles are unjittered
+uniform float sliceScale;
+uniform float sliceBias;
+
+// Cube shadow maps of the most important lights, filled by ShadowAtlas. A light's second texel holds its slot in w.
+uniform bool shadows;
+uniform sampler2DShadow shadowAtlas;
+uniform samplerBuffer shadowData;  // per slot and face: tile rect, then the position it was rendered from and far
+uniform mat4 viewToWorld;
+uniform float shadowTexel;
+
+const ivec3 clusterDims = ivec3(16, 9, 24);
+const float ambient = 0.15;
+const float shadowNear = 0.05;  // ShadowAtlas::nearPlane
+const float normalOffset = 0.03;
+
+// Per face +x, -x, +y, -y, +z, -z: the axes lookAt() builds for ShadowAtlas's up vectors
+const vec3 faceForward[6] = vec3[6](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1),
+                                    vec3(0, 0, -1));
+const vec3 faceRight[6] = vec3[6](vec3(0, 0, 1), vec3(0, 0, -1), vec3(-1, 0, 0), vec3(-1, 0, 0), vec3(-1, 0, 0),
+                                  vec3(1, 0, 0));
+const vec3 faceUp[6] = vec3[6](vec3(0, 1, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 0, 1), vec3(0, 1, 0),
+                               vec3(0, 1, 0));
+
+// Fraction of the light reaching worldPos, 2x2 PCF from the comparison sampler. No mips, the explicit LOD keeps
+// the lookup legal inside the light loop's branches.
+float shadowFactor(int slot, vec3 worldPos, vec3 lightPos)
+{
+    vec3 toFragment = worldPos - lightPos;
+    vec3 a = abs(toFragment);
+    int face = a.x >= a.y && a.x >= a.z ? (toFragment.x > 0.0 ? 0 : 1)
+                                        : (a.y >= a.z ? (toFragment.y > 0.0 ? 2 : 3) : (toFragment.z > 0.0 ? 4 : 5));
+    vec4 tile = texelFetch(shadowData, slot * 12 + face * 2);
+    vec4 origin = texelFetch(shadowData, slot * 12 + face * 2 + 1);
+
+    // A stale face was rendered from where the light used to be
+    vec3 d = worldPos - origin.xyz;
+    float z = dot(d, faceForward[face]);
+    if (z <= shadowNear)
+    {
+        return 1.0;
+    }
+    vec2 ndc = vec2(dot(d, faceRight[face]), dot(d, faceUp[face])) / z;
+    // Half a texel inside the tile so filtering never reads the neighbour
+    float inset = 0.5 * shadowTexel / tile.z;
+    vec2 uv = tile.xy + clamp(ndc * 0.5 + 0.5, inset, 1.0 - inset) * tile.z;
+    // Window depth perspective() gives a point z in front of the face
+    float farPlane = origin.w;
+    float ndcDepth = (farPlane + shadowNear - 2.0 * farPlane * shadowNear / z) / (farPlane - shadowNear);
+    return textureLod(shadowAtlas, vec3(uv, ndcDepth * 0.5 + 0.5), 0.0);
+}
+
+vec3 shade(vec3 albedo)
+{
+    // Flat quads, the face normal from the derivatives points at the camera on either side
+    vec3 normal = normalize(cross(dFdx(ViewPos), dFdy(ViewPos)));
+
+    ivec2 tile = clamp(ivec2((gl_FragCoord.xy + tileJitter) / tileSize), ivec2(0), clusterDims.xy - 1);
+    int slice = clamp(int(log(-ViewPos.z) * sliceScale + sliceBias), 0, clusterDims.z - 1);
+    uvec2 range = texelFetch(clusterData, (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x).xy;
+
+    // Shadow lookups start slightly off the surface, against acne on walls the light grazes
+    vec3 worldNormal = mat3(viewToWorld) * normal;
+    vec3 worldPos = vec3(viewToWorld * vec4(ViewPos, 1.0)) + worldNormal * normalOffset;
+
+    vec3 light = vec3(ambient);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int index = int(texelFetch(lightIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(lightData, index * 2);
+        vec4 colorSlot = texelFetch(lightData, index * 2 + 1);
+        vec3 color = colorSlot.rgb;
+        int slot = int(colorSlot.w);
+
+        vec3 toLight = positionRadius.xyz - ViewPos;
+        float distance2 = dot(toLight, toLight);
+        float falloff = clamp(1.0 - distance2 / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        float lit = falloff * falloff * max(dot(normal, toLight * inversesqrt(distance2)), 0.0);
+        if (shadows && slot >= 0 && lit > 0.0)
+        {
+            lit *= shadowFactor(slot, worldPos, vec3(viewToWorld * vec4(positionRadius.xyz, 1.0)));
+        }
+        light += color * lit;
+    }
+    return albedo * light;
+}
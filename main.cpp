@@ -1,32 +1,77 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "asset_watcher.h"
+#include "clustered_lights.h"
+#include "culling.h"
+#include "dynamic_resolution.h"
+#include "frame_pacer.h"
+#include "gl_ext.h"
+#include "gl_state.h"
+#include "gpu_driven.h"
+#include "gpu_timer.h"
+#include "instancing.h"
 #include "math.h"
+#include "mesh.h"
+#include "mouse_input.h"
+#include "occlusion.h"
+#include "overdraw.h"
+#include "particles.h"
+#include "portals.h"
+#include "render_graph.h"
+#include "render_queue.h"
+#include "scene.h"
 #include "shader.h"
+#include "shadow_atlas.h"
+#include "simulation.h"
+#include "ssao.h"
+#include "software_occlusion.h"
+#include "static_batch.h"
+#include "stream_buffer.h"
+#include "temporal_upsampler.h"
+#include "texture.h"
+#include "thread_pool.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <stb_image.h>
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
-void processInput(GLFWwindow* window);
+void reportStats(float currentFrame);
+void printBenchmark();
+void printLightBenchmark();
+void printThreadBenchmark();
+void printParticleBenchmark();
+SimulationInput sampleInput(GLFWwindow* window);
 void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void applyWindowEvents();
+void handleKey(int key);
 
 int screenWidth = 1200;
 int screenHeight = 800;
 
-// camera
-const float cameraPosY = 0.5f;
-vec3 cameraPos{2.0f, cameraPosY, -3.0f};
-vec3 cameraFront{0.0f, 0.0f, -1.0f};
-vec3 cameraUp{0.0f, 1.0f, 0.0f};
+// Late input polls events in the middle of a frame, so key presses and resizes are only queued by their callbacks
+// and applyWindowEvents() acts on them at the start of the next frame. Mouse motion and scrolling only feed input
+// that is sampled at fixed points anyway.
+std::vector<int> pendingKeys;
+bool resizePending = false;
+int pendingWidth = 0;
+int pendingHeight = 0;
 
-bool firstMouse = true;
+// camera, the mouse and scroll state here is sampled into the simulation every frame
+MouseInput mouseInput;
 float yaw = -90.0f;  // yaw is initialized to -90.0 degrees since a yaw of 0.0 results in a direction vector pointing to
                      // the right so we initially rotate a bit to the left.
 float pitch = 0.0f;
-float lastX = static_cast<float>(screenWidth) / 2.0;
-float lastY = static_cast<float>(screenHeight) / 2.0;
 float fov = 45.0f;
 
 const float perspectiveNear = 0.1f;
@@ -36,14 +81,226 @@ const float perspectiveFar = 100.0f;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// mechanics
-bool jumping = false;
-const float jumpYLimit = 2.0f;
-const float jumpVelocity = 4.5f;
-const float cameraVelocity = 10.5;
+// Stats, averaged per frame and printed once per second
+float statsTime = 0.0f;
+int statsFrames = 0;
 
-int main()
+// rendering
+enum class RenderPath
 {
+    PerObject,    // one glDrawElements and model upload per surface
+    Instanced,    // one glDrawElementsInstanced per material
+    StaticBatch,  // one glDrawElements per material over pre-transformed vertices
+    GpuDriven     // compute culling and one glMultiDrawElementsIndirect, GL 4.3 only
+};
+const char* renderPathNames[] = {"per-object", "instanced", "static batch", "gpu driven"};
+const int renderPathCount = 4;
+bool gpuDrivenSupported = false;
+RenderPath renderPath = RenderPath::Instanced;
+enum class DepthMode
+{
+    Sorted,       // state-first keys, depth only orders draws that share program and texture
+    FrontToBack,  // depth-first keys and instances, nearest surfaces shade first
+    PrePass       // position-only pass fills depth, the shading pass tests GL_EQUAL without writing it
+};
+const char* depthModeNames[] = {"sorted", "front to back", "depth pre-pass"};
+const int depthModeCount = 3;
+DepthMode depthMode = DepthMode::Sorted;
+bool visualizeOverdraw = false;
+bool clusteredLighting = true;
+int lightCount = 1024;
+bool animateLights = true;
+bool shadowsEnabled = true;
+int shadowBudget = 12;
+// The scene renders offscreen at a scale picked from the GPU frame time and is upscaled to the window
+bool dynamicResolution = true;
+float gpuBudgetMs = 16.0f;
+bool sharpenUpscale = true;
+const float upscaleSharpness = 0.4f;
+// Temporal upsampling renders at most this scale and accumulates jittered frames back to full resolution
+bool temporalUpsampling = true;
+const float temporalMaxScale = 0.7f;
+enum class AoMode
+{
+    Off,
+    Half,    // occlusion at half the render resolution
+    Quarter  // and at a quarter, for the slowest machines
+};
+const char* aoModeNames[] = {"off", "half", "quarter"};
+const int aoModeCount = 3;
+AoMode aoMode = AoMode::Half;
+bool aoAccumulation = true;
+// Dust and sparks, simulated by a compute shader where GL 4.3 allows it and on the worker threads otherwise
+bool particlesEnabled = true;
+bool gpuParticles = true;
+unsigned int particleCount = 65536;
+// X (or --dump-graph at startup) prints the next frame's compiled render graph
+bool dumpGraph = false;
+int corridorSegments = 7;
+RenderQueue renderQueue;
+const mat4 identity{1.0f};
+bool frustumCulling = true;
+bool portalCulling = true;
+bool occlusionCulling = true;
+bool softwareOcclusionCulling = true;
+bool instancesCulled = false;
+
+// --bench renders a fixed number of frames with every render path and prints the averages
+bool benchmark = false;
+const int benchmarkFrames = 300;
+struct BenchmarkResult
+{
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    unsigned long draws = 0;
+    double overdraw = 0.0;
+    int frames = 0;
+} benchmarkResults[renderPathCount];
+
+// --bench-lights renders the same number of frames at each light count, showing how clustered shading scales
+bool lightBenchmark = false;
+const int lightBenchmarkCounts[] = {0, 256, 1024, 4096, 16384};
+const int lightBenchmarkSteps = 5;
+struct LightBenchmarkResult
+{
+    double cpuMs = 0.0;
+    double assignMs = 0.0;
+    double gpuMs = 0.0;
+    double indices = 0.0;
+    int frames = 0;
+} lightBenchmarkResults[lightBenchmarkSteps];
+
+// Per-object draws are recorded and encoded into command buffers on the worker threads, the GL thread only replays
+bool multithreadedRecording = true;
+// --bench-threads records the per-object path with more and more threads, culling off and best with --segments
+bool threadBenchmark = false;
+const unsigned int threadBenchmarkCounts[] = {1, 2, 4, 8, 16};
+const int threadBenchmarkSteps = 5;
+struct ThreadBenchmarkResult
+{
+    double cpuMs = 0.0;
+    double recordMs = 0.0;
+    double encodeMs = 0.0;
+    double replayMs = 0.0;
+    double items = 0.0;
+    int frames = 0;
+} threadBenchmarkResults[threadBenchmarkSteps];
+
+// --bench-particles simulates every count on the CPU and then the GPU, reporting particles per millisecond
+bool particleBenchmark = false;
+const unsigned int particleBenchmarkCounts[] = {65536, 262144, 1048576};
+const int particleBenchmarkSteps = 3;
+struct ParticleBenchmarkResult
+{
+    double simulateMs = 0.0;
+    double drawMs = 0.0;
+    int frames = 0;
+} particleBenchmarkResults[particleBenchmarkSteps][2];
+
+// Camera mechanics and lights step on their own thread, overlapping the previous frame's rendering
+bool threadedSimulation = true;
+
+// Frames the CPU may queue ahead of the GPU, 1-3. Late input polls again right before the view matrix is built.
+int framesInFlight = 2;
+bool lateInput = true;
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        // --segments N builds a longer corridor for stress testing
+        if (std::string{argv[i]} == "--segments" && i + 1 < argc)
+        {
+            corridorSegments = std::max(1, std::atoi(argv[++i]));
+        }
+        if (std::string{argv[i]} == "--bench")
+        {
+            benchmark = true;
+        }
+        // --lights N sets the number of point lights, --bench-lights measures a range of counts instead
+        if (std::string{argv[i]} == "--lights" && i + 1 < argc)
+        {
+            lightCount = std::max(0, std::atoi(argv[++i]));
+        }
+        if (std::string{argv[i]} == "--bench-lights")
+        {
+            lightBenchmark = true;
+        }
+        if (std::string{argv[i]} == "--bench-threads")
+        {
+            threadBenchmark = true;
+        }
+        // --particles N sets the number of particles, --cpu-particles simulates them on the CPU even with GL 4.3
+        if (std::string{argv[i]} == "--particles" && i + 1 < argc)
+        {
+            particleCount = static_cast<unsigned int>(std::max(0, std::atoi(argv[++i])));
+            particlesEnabled = particleCount > 0;
+        }
+        if (std::string{argv[i]} == "--cpu-particles")
+        {
+            gpuParticles = false;
+        }
+        if (std::string{argv[i]} == "--bench-particles")
+        {
+            particleBenchmark = true;
+        }
+        // --shadow-budget N caps the shadow map tiles re-rendered per frame
+        if (std::string{argv[i]} == "--shadow-budget" && i + 1 < argc)
+        {
+            shadowBudget = std::max(1, std::atoi(argv[++i]));
+        }
+        // --gpu-budget MS sets the GPU frame time dynamic resolution aims for
+        if (std::string{argv[i]} == "--gpu-budget" && i + 1 < argc)
+        {
+            gpuBudgetMs = std::max(1.0f, static_cast<float>(std::atof(argv[++i])));
+        }
+        // --ssao off|half|quarter sets the ambient occlusion resolution
+        if (std::string{argv[i]} == "--ssao" && i + 1 < argc)
+        {
+            const std::string mode{argv[++i]};
+            if (mode == "off")
+                aoMode = AoMode::Off;
+            else if (mode == "quarter")
+                aoMode = AoMode::Quarter;
+            else
+                aoMode = AoMode::Half;
+        }
+        // --depth-mode sorted|front-to-back|prepass picks the opaque ordering, so benchmarks can compare them
+        if (std::string{argv[i]} == "--depth-mode" && i + 1 < argc)
+        {
+            const std::string mode{argv[++i]};
+            if (mode == "front-to-back")
+                depthMode = DepthMode::FrontToBack;
+            else if (mode == "prepass")
+                depthMode = DepthMode::PrePass;
+            else
+                depthMode = DepthMode::Sorted;
+        }
+        // --inline-simulation steps the simulation on the render thread, easier to debug
+        if (std::string{argv[i]} == "--inline-simulation")
+        {
+            threadedSimulation = false;
+        }
+        // --frames-in-flight N bounds how far the CPU runs ahead, --early-input aims with the frame's first sample
+        if (std::string{argv[i]} == "--frames-in-flight" && i + 1 < argc)
+        {
+            framesInFlight = std::clamp(std::atoi(argv[++i]), 1, FramePacer::maxFramesInFlight);
+        }
+        if (std::string{argv[i]} == "--early-input")
+        {
+            lateInput = false;
+        }
+        if (std::string{argv[i]} == "--dump-graph")
+        {
+            dumpGraph = true;
+        }
+        // --gl-debug checks the GL state cache against glGet* every frame
+        if (std::string{argv[i]} == "--gl-debug")
+        {
+            glState.debug = true;
+        }
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -59,105 +316,226 @@ int main()
     glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
     glfwSetCursorPosCallback(window, mouseCallback);
     glfwSetScrollCallback(window, scrollCallback);
+    glfwSetKeyCallback(window, keyCallback);
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+    // Raw motion skips the desktop's pointer acceleration, GLFW only delivers it with the cursor disabled
+    if (glfwRawMouseMotionSupported())
+    {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    }
 
     assert(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) && "Failed to initialize GLAD");
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+    gpuDrivenSupported = GpuDrivenRenderer::supported();
+    if (!gpuDrivenSupported)
+    {
+        std::cout << "GL 4.3 not available, the gpu driven render path is disabled" << std::endl;
+    }
 
-    glEnable(GL_DEPTH_TEST);
+    glState.enable(GL_DEPTH_TEST);
 
     // tell stb_image.h to flip loaded texture's on the y-axis.
     stbi_set_flip_vertically_on_load(true);
 
-    GLuint floorTexture1, floorTexture2, wallTexture1;
-    glGenTextures(1, &floorTexture1);
-    glGenTextures(1, &floorTexture2);
-    glGenTextures(1, &wallTexture1);
-
-    ///////////////////// FLOOR TEXTURE 1 /////////////////////
-    int width, height, nrChannels;
-    glBindTexture(GL_TEXTURE_2D, floorTexture1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    auto* data = stbi_load("./resources/floor_1.png", &width, &height, &nrChannels, 0);
-    assert(data && "Failed to load texture 'floor_1.png'");
-    glBindTexture(GL_TEXTURE_2D, floorTexture1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
-    ///////////////////////////////////////////////////////////
-
-    ///////////////////// FLOOR TEXTURE 2 /////////////////////
-    glBindTexture(GL_TEXTURE_2D, floorTexture2);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    data = stbi_load("./resources/floor_2.jpg", &width, &height, &nrChannels, 0);
-    assert(data && "Failed to load texture 'floor_2.jpg'");
-    glBindTexture(GL_TEXTURE_2D, floorTexture2);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
-    ///////////////////////////////////////////////////////////
-
-    ///////////////////// WALL TEXTURE 1 /////////////////////
-    glBindTexture(GL_TEXTURE_2D, wallTexture1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    data = stbi_load("./resources/wall_1.jpg", &width, &height, &nrChannels, 0);
-    assert(data && "Failed to load texture 'wall_1.jpg'");
-    glBindTexture(GL_TEXTURE_2D, wallTexture1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
-    ///////////////////////////////////////////////////////////
-    Shader shader{"rect.vert", "rect.frag"};
-
-    float vertices[] = {
-        // positions          // colors           // texture coords
-        0.5f,  0.5f,  0.0f, 1.0f, 1.0f,  // top right
-        0.5f,  -0.5f, 0.0f, 1.0f, 0.0f,  // bottom right
-        -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,  // bottom left
-        -0.5f, 0.5f,  0.0f, 0.0f, 1.0f   // top left
-    };
+    GLuint floorTexture1 = loadTexture("./resources/floor_1.png");
+    assert(floorTexture1 && "Failed to load texture 'floor_1.png'");
+    GLuint floorTexture2 = loadTexture("./resources/floor_2.jpg");
+    assert(floorTexture2 && "Failed to load texture 'floor_2.jpg'");
+    GLuint wallTexture1 = loadTexture("./resources/wall_1.jpg");
+    assert(wallTexture1 && "Failed to load texture 'wall_1.jpg'");
 
-    unsigned int indices[] = {
-        0, 1, 3,  // first Triangle
-        1, 2, 3   // second Triangle
-    };
+    Shader shader{"rect.vert", "rect.frag"};
+    Shader instancedShader{"rect_instanced.vert", "rect.frag"};
+    Shader depthShader{"depth.vert", "depth.frag"};
+    Shader depthInstancedShader{"depth_instanced.vert", "depth.frag"};
+
+    // Rebuild shaders and textures in the background when they change on disk, release builds stay off the disk
+    AssetWatcher watcher{window};
+    watcher.watchShader(shader);
+    watcher.watchShader(instancedShader);
+    watcher.watchShader(depthShader);
+    watcher.watchShader(depthInstancedShader);
+    watcher.watchTexture("./resources/floor_1.png", floorTexture1);
+    watcher.watchTexture("./resources/floor_2.jpg", floorTexture2);
+    watcher.watchTexture("./resources/wall_1.jpg", wallTexture1);
+
+    Mesh quad = createMesh(quadVertices, quadIndices);
+    auto scene = buildCorridor(corridorSegments);
+
+    // One instance buffer per material, the whole corridor is a draw call per material
+    std::vector<std::unique_ptr<InstanceBuffer>> instances;
+    for (const auto& group : groupInstances(scene))
+    {
+        instances.push_back(std::make_unique<InstanceBuffer>(quad));
+        instances.back()->upload(group);
+    }
 
-    GLuint VAO, VBO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+    // Every surface baked into one pre-transformed mesh per material
+    StaticBatchBuilder batchBuilder;
+    for (const auto& renderable : scene)
+    {
+        batchBuilder.add(quadVertices, quadIndices, renderable.model, renderable.material);
+    }
+    auto batches = batchBuilder.build();
+
+    // World-space bounds for culling, parallel to scene
+    const auto sceneBounds = computeSceneBounds(scene);
+    std::vector<unsigned int> visible;
+    auto cellGraph = buildCorridorCells(corridorSegments, sceneBounds);
+    std::vector<std::vector<InstanceData>> visibleInstances(MaterialCount);
+
+    // Every cell is an occlusion group, surfaces spanning several cells are always drawn
+    std::vector<Bounds> cellBounds;
+    for (const auto& cell : cellGraph.cells)
+        cellBounds.push_back(cell.bounds);
+    const auto occlusionGroups = assignOcclusionGroups(cellBounds, sceneBounds);
+    auto occlusion = std::make_unique<OcclusionCuller>(cellBounds);
+    watcher.watchShader(occlusion->shader());
+
+    // Objects, culling and draw commands all on the GPU when the context allows it
+    std::unique_ptr<GpuDrivenRenderer> gpuDriven;
+    if (gpuDrivenSupported)
+    {
+        gpuDriven = std::make_unique<GpuDrivenRenderer>(quad, scene, sceneBounds);
+        watcher.watchShader(gpuDriven->cullProgram());
+        watcher.watchShader(gpuDriven->drawProgram());
+    }
 
-    glBindVertexArray(VAO);
+    // Walls rasterized on the CPU hide what is behind them without waiting for query results
+    ThreadPool workers;
+    SoftwareOcclusion softwareOcclusion{workers};
+
+    auto overdraw = std::make_unique<OverdrawMeter>();
+    watcher.watchShader(overdraw->shader());
+
+    // Point lights drifting through the corridor cells, assigned to view clusters every frame
+    std::vector<Bounds> lightAreas;
+    for (const auto& cell : cellGraph.cells)
+        lightAreas.push_back(cell.bounds);
+    auto clusteredLights = std::make_unique<ClusteredLights>(workers);
+
+    // The corridor casts the shadows, it never moves so its depth is cached per light
+    std::vector<ShadowCaster> staticCasters;
+    for (size_t i = 0; i < scene.size(); i++)
+        staticCasters.push_back({quad.VAO, quad.indexCount, &scene[i].model, sceneBounds[i]});
+    const std::vector<ShadowCaster> dynamicCasters;
+    const std::vector<int> noShadows;
+    auto shadowAtlas = std::make_unique<ShadowAtlas>(shadowBudget);
+    watcher.watchShader(shadowAtlas->shader());
+
+    // Offscreen target sized for the largest window, the controller picks how much of it each frame renders
+    auto sceneTarget = std::make_unique<SceneTarget>();
+    watcher.watchShader(sceneTarget->shader());
+    ResolutionController resolution{gpuBudgetMs};
+    auto temporal = std::make_unique<TemporalUpsampler>();
+    watcher.watchShader(temporal->velocityProgram());
+    watcher.watchShader(temporal->resolveProgram());
+    auto ambientOcclusion = std::make_unique<AmbientOcclusion>();
+    for (int pass = 0; pass < AmbientOcclusion::PassCount; pass++)
+        watcher.watchShader(ambientOcclusion->program(static_cast<AmbientOcclusion::Pass>(pass)));
+
+    // Dust drifting through the whole corridor and fountains of sparks falling from the ceiling every other segment.
+    // Cells run along -z, the first and last one span the corridor and buildCorridor() adds the floor last.
+    const vec3 corridorMin = cellBounds.back().center - cellBounds.back().extents;
+    const vec3 corridorMax = cellBounds.front().center + cellBounds.front().extents;
+    std::vector<ParticleEmitter> emitters;
+    ParticleEmitter dust;
+    dust.center = (corridorMin + corridorMax) * 0.5f;
+    dust.extents = (corridorMax - corridorMin) * 0.5f;
+    dust.velocity = vec3{0.0f, 0.02f, 0.0f};
+    dust.spread = vec3{0.06f, 0.04f, 0.06f};
+    dust.drag = 0.1f;
+    dust.minLife = 6.0f;
+    dust.maxLife = 14.0f;
+    dust.size = 0.015f;
+    dust.color = vec3{0.35f, 0.32f, 0.28f};
+    dust.material = MaterialFloor;
+    dust.share = 8.0f;
+    emitters.push_back(dust);
+    for (int segment = 1; segment < corridorSegments && emitters.size() < ParticleSystem::maxEmitters; segment += 2)
+    {
+        ParticleEmitter sparks;
+        sparks.center = vec3{segment % 4 == 1 ? 1.0f : 7.5f, corridorMax.y - 0.2f, -segment * corridorSegmentLength};
+        sparks.extents = vec3{0.05f, 0.02f, 0.05f};
+        sparks.velocity = vec3{0.0f, -0.5f, 0.0f};
+        sparks.spread = vec3{1.2f, 0.6f, 1.2f};
+        sparks.gravity = 9.8f;
+        sparks.drag = 0.3f;
+        sparks.minLife = 0.8f;
+        sparks.maxLife = 1.6f;
+        sparks.size = 0.02f;
+        sparks.color = vec3{2.5f, 1.2f, 0.35f};
+        sparks.material = MaterialWall;
+        sparks.share = 0.25f;
+        emitters.push_back(sparks);
+    }
+    gpuParticles = gpuParticles && ParticleSystem::gpuSupported();
+    auto particles = std::make_unique<ParticleSystem>(workers, emitters, sceneBounds.back().center.y, particleCount);
+    if (auto* program = particles->simulateProgram())
+        watcher.watchShader(*program);
+    watcher.watchShader(particles->drawProgram());
+    // Everything after the scene pass, rebuilt every frame over textures it keeps between frames
+    auto renderGraph = std::make_unique<RenderGraph>();
+
+#ifdef CLAUSTROPHOBIA_DEV_ASSETS
+    watcher.start({".", "./resources"});
+#endif
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // Loaders bind through raw GL, start the frame loop from a clean cache
+    glState.invalidate();
+    glState.activeTexture(0);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    // Per-frame data is written straight into mapped memory, sized for every instance of the scene plus slack
+    auto streamBuffer = std::make_unique<StreamBuffer>(
+        std::max<GLsizeiptr>(1 << 20, 2 * scene.size() * sizeof(InstanceData)));
+    if (!streamBuffer->persistent())
+    {
+        std::cout << "buffer storage not available, streaming by orphaning" << std::endl;
+    }
 
-    // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // Texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    /////////////////////////////////////////////////////////
+    auto pacer = std::make_unique<FramePacer>(framesInFlight);
 
-    glBindVertexArray(VAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, floorTexture1);
+    GpuTimer gpuTimer;
+    int benchmarkFrame = 0;
+    int lightBenchmarkStep = 0;
+    int threadBenchmarkStep = 0;
+    int particleBenchmarkStep = 0;
+    if (benchmark)
+    {
+        renderPath = RenderPath::PerObject;
+        glfwSwapInterval(0);
+    }
+    else if (lightBenchmark)
+    {
+        lightCount = lightBenchmarkCounts[0];
+        glfwSwapInterval(0);
+    }
+    else if (threadBenchmark)
+    {
+        // Every segment in the frustum records, so the work is there to spread
+        renderPath = RenderPath::PerObject;
+        multithreadedRecording = true;
+        portalCulling = false;
+        occlusionCulling = false;
+        softwareOcclusionCulling = false;
+        glfwSwapInterval(0);
+    }
+    else if (particleBenchmark)
+    {
+        particlesEnabled = true;
+        gpuParticles = false;
+        particles->resize(particleBenchmarkCounts[0]);
+        glfwSwapInterval(0);
+    }
+    // Benchmarks compare work at a fixed resolution, the others leave out the particles' constant cost
+    if (benchmark || lightBenchmark || threadBenchmark || particleBenchmark)
+    {
+        dynamicResolution = false;
+        particlesEnabled = particleBenchmark && !benchmark && !lightBenchmark && !threadBenchmark;
+    }
+    Simulation simulation{lightAreas, vec3{2.0f, Simulation::groundY, -3.0f}};
 
     while (!glfwWindowShouldClose(window))
     {
@@ -165,199 +543,700 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        processInput(window);
+        applyWindowEvents();
+        watcher.apply();
+
+        // Last frame's query results, whatever has not arrived yet is picked up next frame
+        if (occlusionCulling)
+            occlusion->update();
+        else
+            occlusion->reset();
+
+        // Everything below renders this snapshot, threaded it was stepped while the last frame rendered and the
+        // next one is stepped while this one renders
+        simulation.setThreaded(threadedSimulation);
+        // Early input turns the camera with the mouse motion queued so far, late input leaves it for the view matrix
+        if (!lateInput)
+            mouseInput.apply(yaw, pitch);
+        const auto& frame = simulation.advance(sampleInput(window));
+        const auto& cameraPos = frame.cameraPos;
+
+        // Scale from the newest GPU time, which trails this frame by a few frames
+        resolution.setCeiling(temporalUpsampling ? temporalMaxScale : 1.0f);
+        if (dynamicResolution && gpuTimer.hasResult())
+            resolution.update(gpuTimer.lastMs());
+        else if (!dynamicResolution)
+            resolution.reset();
+        sceneTarget->resize(screenWidth, screenHeight, resolution.scale());
+        sceneTarget->bind();
+
+        // glClear honours the write masks
+        glState.colorMask(true);
+        glState.depthMask(true);
+        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | (visualizeOverdraw ? GL_STENCIL_BUFFER_BIT : 0));
+
+        const auto submitBegin = std::chrono::steady_clock::now();
+        const auto frameDraws = renderQueue.stats.draws + (gpuDriven ? gpuDriven->stats.multiDraws : 0);
+        gpuTimer.begin();
+        streamBuffer->beginFrame();
+
+        // Late input aims the camera with the mouse as of now, the snapshot's direction was sampled at the start of
+        // the frame or threaded during the one before. Movement stays with the snapshot. Other events polled here
+        // wait for the next frame.
+        auto cameraFront = frame.cameraFront;
+        auto inputSampled = frame.inputSampled;
+        if (lateInput)
+        {
+            glfwPollEvents();
+            mouseInput.apply(yaw, pitch);
+            cameraFront = Simulation::facing(yaw, pitch);
+            inputSampled = std::chrono::steady_clock::now();
+        }
+        pacer->markInput(inputSampled);
+
+        auto view = lookAt(cameraPos, cameraPos + cameraFront, frame.cameraUp);
+        auto proj =
+            perspective(radians(frame.fov), float(screenWidth) / float(screenHeight), perspectiveNear, perspectiveFar);
+        // Draws go through a sub-pixel jitter while temporal upsampling accumulates them, culling never does
+        const auto drawProj =
+            temporalUpsampling ? temporal->jitter(proj, sceneTarget->width(), sceneTarget->height()) : proj;
+
+        const GLuint materialTextures[MaterialCount] = {wallTexture1, floorTexture1};
+
+        // Cull against the camera before anything is recorded, the queue only ever sees visible draws
+        auto viewProj = proj * view;
+        const auto frustum = extractFrustum(viewProj);
+
+        // Lighting runs for every path, it only depends on the camera and the lights
+        const auto assignBegin = clusterStats.assignMs;
+        const auto indicesBegin = clusterStats.indices;
+        const bool shadowing = clusteredLighting && shadowsEnabled;
+        if (shadowing)
+        {
+            shadowAtlas->update(frame.lights, cameraPos, frustum, proj[1][1], staticCasters, dynamicCasters);
+            sceneTarget->bind();
+        }
+        // Clusters tile the rendered region, not the window
+        clusteredLights->update(frame.lights, shadowing ? shadowAtlas->slots() : noShadows, view, drawProj,
+                                perspectiveNear, perspectiveFar, sceneTarget->width(), sceneTarget->height());
+        const auto viewToWorld = inverseRigid(view);
+        for (Shader* lit : {&shader, &instancedShader, gpuDriven ? &gpuDriven->drawProgram() : nullptr})
+        {
+            if (!lit)
+            {
+                continue;
+            }
+            clusteredLights->apply(*lit, clusteredLighting);
+            shadowAtlas->apply(*lit, viewToWorld, shadowing);
+        }
+        // The GPU-driven path culls on the GPU, its CPU cost must not depend on the scene
+        if (renderPath == RenderPath::GpuDriven)
+        {
+            visible.clear();
+        }
+        else
+        {
+            // The portal walk only reaches cells seen through doorways, outside the level fall back to the frustum
+            const bool walked = portalCulling && cellGraph.walk(cameraPos, frustum, sceneBounds, visible);
+            if (!walked && frustumCulling)
+            {
+                frustumCull(frustum, sceneBounds, visible);
+            }
+            else if (!walked)
+            {
+                visible.resize(scene.size());
+                for (unsigned int i = 0; i < scene.size(); i++)
+                    visible[i] = i;
+            }
+            if (softwareOcclusionCulling)
+            {
+                softwareOcclusion.begin(viewProj);
+                for (auto i : visible)
+                {
+                    if (scene[i].material == MaterialWall)
+                        softwareOcclusion.addOccluder(quadVertices, quadIndices, scene[i].model);
+                }
+                softwareOcclusion.rasterize();
+                softwareOcclusion.cull(sceneBounds, visible);
+            }
+            // Instances draw in buffer order, sorting them is the only way to get them front to back
+            if (depthMode != DepthMode::Sorted)
+            {
+                std::sort(visible.begin(), visible.end(),
+                          [&](unsigned int a, unsigned int b)
+                          {
+                              return (sceneBounds[a].center - cameraPos).magnitude() <
+                                     (sceneBounds[b].center - cameraPos).magnitude();
+                          });
+            }
+        }
 
-        // Jumping
-        if (jumping)
+        // After a pre-pass the depth buffer already holds the nearest surface, only fragments matching it shade
+        const bool prePass = depthMode == DepthMode::PrePass && renderPath != RenderPath::GpuDriven;
+        const auto order = depthMode == DepthMode::Sorted ? SortOrder::StateFirst : SortOrder::DepthFirst;
+        renderQueue.setPassState(RenderPass::Opaque, prePass ? PassState{true, false, GL_EQUAL} : PassState{});
+
+        // Every path only records draw items, the queue decides the order and which binds are needed
+        renderQueue.setWorkers(multithreadedRecording ? &workers : nullptr,
+                               threadBenchmark ? threadBenchmarkCounts[threadBenchmarkStep] : workers.size());
+        const auto queueBefore = renderQueue.stats;
+        renderQueue.clear();
+        if (renderPath == RenderPath::Instanced)
         {
-            const float jumpSpeed = jumpVelocity * deltaTime;
-            cameraPos.y += jumpSpeed;
+            instancedShader.setMat4("view", view);
+            instancedShader.setMat4("proj", drawProj);
+            depthInstancedShader.setMat4("view", view);
+            depthInstancedShader.setMat4("proj", drawProj);
 
-            if (cameraPos.y >= jumpYLimit)
+            // The full corridor stays uploaded, culling streams just the visible instances each frame
+            if (frustumCulling || portalCulling || occlusionCulling || softwareOcclusionCulling)
             {
-                jumping = false;
+                for (auto& group : visibleInstances)
+                    group.clear();
+                for (auto i : visible)
+                    if (!occlusionCulling || !occlusion->isOccluded(occlusionGroups[i]))
+                        visibleInstances[scene[i].material].push_back({scene[i].model, scene[i].material});
+                for (unsigned int material = 0; material < MaterialCount; material++)
+                {
+                    const auto& group = visibleInstances[material];
+                    const GLsizeiptr bytes = group.size() * sizeof(InstanceData);
+                    if (auto allocation = streamBuffer->allocate(bytes))
+                    {
+                        std::memcpy(allocation.data, group.data(), bytes);
+                        instances[material]->useInstances(allocation.buffer, allocation.offset, group.size());
+                    }
+                    else
+                    {
+                        instances[material]->upload(group, GL_STREAM_DRAW);
+                    }
+                }
+                instancesCulled = true;
+            }
+            else if (instancesCulled)
+            {
+                const auto groups = groupInstances(scene);
+                for (unsigned int material = 0; material < MaterialCount; material++)
+                    instances[material]->upload(groups[material]);
+                instancesCulled = false;
+            }
+
+            for (unsigned int material = 0; material < MaterialCount; material++)
+            {
+                const auto& buffer = *instances[material];
+                if (!buffer.count())
+                {
+                    continue;
+                }
+                renderQueue.push({makeSortKey(RenderPass::Opaque, instancedShader.sortIndex, material, 0.0f,
+                                              perspectiveFar),
+                                  &instancedShader, buffer.vertexArray(), materialTextures[material], buffer.indices(),
+                                  buffer.count(), nullptr, 0});
+                if (prePass)
+                {
+                    renderQueue.push({makeSortKey(RenderPass::DepthPrepass, depthInstancedShader.sortIndex, 0, 0.0f,
+                                                  perspectiveFar),
+                                      &depthInstancedShader, buffer.vertexArray(), 0, buffer.indices(), buffer.count(),
+                                      nullptr, 0});
+                }
             }
         }
-        // Falling
-        if (!jumping && cameraPos.y > cameraPosY)
+        else if (renderPath == RenderPath::PerObject)
         {
-            const float jumpSpeed = jumpVelocity * deltaTime;
-            cameraPos.y -= jumpSpeed;
+            shader.setMat4("view", view);
+            shader.setMat4("proj", drawProj);
+            depthShader.setMat4("view", view);
+            depthShader.setMat4("proj", drawProj);
+
+            // Partitions of the visible list record on the workers, nothing in here may touch GL
+            renderQueue.record(
+                static_cast<unsigned int>(visible.size()),
+                [&](unsigned int first, unsigned int last, RenderQueue::Recorder& recorder)
+                {
+                    for (unsigned int v = first; v < last; v++)
+                    {
+                        const auto i = visible[v];
+                        // Hidden groups are dropped here, groups about to be hidden let the GPU decide per draw
+                        const int group = occlusionCulling ? occlusionGroups[i] : -1;
+                        if (occlusion->isOccluded(group))
+                        {
+                            continue;
+                        }
+                        const auto& renderable = scene[i];
+                        const float depth = (sceneBounds[i].center - cameraPos).magnitude();
+                        const auto key = makeSortKey(RenderPass::Opaque, shader.sortIndex, renderable.material, depth,
+                                                     perspectiveFar, order);
+                        recorder.push({key, &shader, quad.VAO, materialTextures[renderable.material],
+                                       quad.indexCount, 0, &renderable.model, occlusion->conditionQuery(group)});
+                        if (prePass)
+                        {
+                            const auto depthKey = makeSortKey(RenderPass::DepthPrepass, depthShader.sortIndex, 0, depth,
+                                                              perspectiveFar, SortOrder::DepthFirst);
+                            recorder.push({depthKey, &depthShader, quad.VAO, 0, quad.indexCount, 0,
+                                           &renderable.model, occlusion->conditionQuery(group)});
+                        }
+                    }
+                });
+        }
+        else if (renderPath == RenderPath::GpuDriven)
+        {
+            // Records nothing, it draws in the opaque pass's place below
+        }
+        else
+        {
+            shader.setMat4("view", view);
+            shader.setMat4("proj", drawProj);
+            depthShader.setMat4("view", view);
+            depthShader.setMat4("proj", drawProj);
 
-            // Adjust cameraY when landing
-            if (cameraPos.y < cameraPosY)
+            // Baked batches can only be culled as a whole
+            for (const auto& batch : batches)
             {
-                cameraPos.y = cameraPosY;  // Ensure camera is at correct position
+                if ((frustumCulling || portalCulling) && !isVisible(frustum, batch.bounds))
+                {
+                    continue;
+                }
+                renderQueue.push({makeSortKey(RenderPass::Opaque, shader.sortIndex, batch.material, 0.0f,
+                                              perspectiveFar),
+                                  &shader, batch.mesh.VAO, materialTextures[batch.material], batch.mesh.indexCount, 0,
+                                  &identity, 0});
+                if (prePass)
+                {
+                    renderQueue.push({makeSortKey(RenderPass::DepthPrepass, depthShader.sortIndex, 0, 0.0f,
+                                                  perspectiveFar),
+                                      &depthShader, batch.mesh.VAO, 0, batch.mesh.indexCount, 0, &identity, 0});
+                }
             }
         }
+        renderQueue.sort();
+        streamBuffer->commit();
+        renderQueue.submit(RenderPass::DepthPrepass);
+        // Only the shading pass counts towards overdraw, the pre-pass exists to bring it down
+        overdraw->begin(visualizeOverdraw, sceneTarget->width() * sceneTarget->height());
+        renderQueue.submit(RenderPass::Opaque);
+        if (renderPath == RenderPath::GpuDriven)
+            gpuDriven->draw(frustum, frustumCulling, view, drawProj, materialTextures);
+        overdraw->end();
+        streamBuffer->endFrame();
+
+        // Dust and sparks blend over the opaque scene and never write depth, nothing after this sees them
+        const auto particlesBefore = particleStats;
+        if (particlesEnabled)
+        {
+            particles->setPath(gpuParticles ? ParticlePath::Gpu : ParticlePath::Cpu);
+            particles->update(deltaTime);
+            particles->draw(view, drawProj, materialTextures);
+        }
 
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Test the group boxes against the depth just written, results are read next frame
+        if (occlusionCulling && renderPath != RenderPath::GpuDriven)
+            occlusion->issueQueries(viewProj, frustum, cameraPos, perspectiveNear);
+
+        // The post chain is declared in full, the toggles only pick what reaches the screen and the graph culls
+        // whatever that leaves unread
+        renderGraph->reset();
+        const auto sceneColor = sceneTarget->importColor(*renderGraph);
+        const auto sceneDepth = sceneTarget->importDepth(*renderGraph);
+        const auto backbuffer = renderGraph->importBackbuffer(std::max(screenWidth, 1), std::max(screenHeight, 1));
+
+        // Needs the finished depth buffer, darkens the colour before it is upscaled
+        if (aoMode != AoMode::Off)
+            ambientOcclusion->addPasses(*renderGraph, sceneColor, sceneDepth, *sceneTarget, view, proj,
+                                        aoMode == AoMode::Half ? 2 : 4, aoAccumulation);
+        else
+            ambientOcclusion->reset();
+
+        if (visualizeOverdraw)
+        {
+            renderGraph->addPass("overdraw heat map", {sceneDepth, sceneColor}, {sceneColor},
+                                 [&](RenderGraph::Context& context)
+                                 {
+                                     context.bindTarget(sceneColor, sceneDepth);
+                                     overdraw->draw();
+                                 });
+        }
 
-        shader.use();
+        // Everything before this renders at the scaled resolution, overlays drawn after it stay at native resolution
+        if (temporalUpsampling)
+        {
+            const auto resolved = temporal->addPasses(*renderGraph, sceneColor, sceneDepth, *sceneTarget, view, proj,
+                                                      screenWidth, screenHeight);
+            temporal->addPresent(*renderGraph, resolved, backbuffer, screenWidth, screenHeight);
+        }
+        else
+        {
+            temporal->release();
+            sceneTarget->addPresent(*renderGraph, sceneColor, backbuffer, sharpenUpscale ? upscaleSharpness : 0.0f);
+        }
+
+        renderGraph->compile();
+        if (dumpGraph)
+        {
+            renderGraph->dump(std::cout);
+            dumpGraph = false;
+        }
+        renderGraph->execute();
 
-        auto view = lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        shader.setMat4("view", view);
+        gpuTimer.end();
+        simulation.endFrame();
 
-        auto proj =
-            perspective(radians(fov), float(screenWidth) / float(screenHeight), perspectiveNear, perspectiveFar);
-        shader.setMat4("proj", proj);
-
-        mat4 model{1.0f};
-
-        /////////////////////////  WALLS /////////////////////////
-        glBindTexture(GL_TEXTURE_2D, wallTexture1);
-
-        for (int i = 0; i < 7; i++)
-        {
-            // Left wall
-            model = mat4{1.0f};
-            model = translate(model, vec3{-0.3f, 0.8f, i * -5.0f});
-            model = rotate(model, radians(90.0f), vec3{0, 1.0f, 0});
-            model = scale(model, vec3{5.0f, 5.5f, 0});
-
-            shader.setMat4("model", model);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-            // Right wall
-            model = translate(model, vec3{10.0f, 0.8f, i * -5.0f});
-            shader.setMat4("model", model);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        }
-        // Far wall
-        model = mat4{1.0f};
-        model = translate(model, vec3{4.5f, 0.8f, -32.0f});
-        model = scale(model, vec3{12.0f, 5.5f, 1.0f});
-        shader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        // Near wall
-        model = mat4{1.0f};
-        model = translate(model, vec3{4.5f, 0.8f, 1.0f});
-        model = scale(model, vec3{12.0f, 5.5f, 1.0f});
-        shader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        //////////////////////////////////////////////////////////
-
-        /////////////////////////  CEILING ///////////////////////
-        glBindTexture(GL_TEXTURE_2D, floorTexture1);
-        model = mat4{1.0f};
-        model = translate(model, vec3{4.5f, 3.5f, -16.0f});
-        model = rotate(model, radians(-90.f), vec3{1.0f, 0, 0});
-        model = scale(model, vec3{12.0f, 40.0f, 1.0f});
-        shader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        //////////////////////////////////////////////////////////
-
-        /////////////////////////  FLOOR /////////////////////////
-        glEnableVertexAttribArray(1);
-        glBindTexture(GL_TEXTURE_2D, floorTexture1);
-        model = mat4{1.0f};
-        model = translate(model, vec3{4.5f, -1.0f, -16.0f});
-        model = rotate(model, radians(-90.0f), vec3{1.0f, 0, 0});
-        model = scale(model, vec3{12.0f, 34.5f, 1.0f});
-        shader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        /////////////////////////////////////////////////////////
+        if (benchmark)
+        {
+            // Skip the first frames of each path so the GPU timer ring holds results from this path only
+            auto& result = benchmarkResults[static_cast<int>(renderPath)];
+            if (++benchmarkFrame > 10)
+            {
+                result.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                          submitBegin)
+                                    .count();
+                result.gpuMs += gpuTimer.lastMs();
+                result.overdraw += overdraw->lastOverdraw();
+                result.draws += renderQueue.stats.draws + (gpuDriven ? gpuDriven->stats.multiDraws : 0) - frameDraws;
+                result.frames++;
+            }
+            if (benchmarkFrame == benchmarkFrames)
+            {
+                benchmarkFrame = 0;
+                if (static_cast<int>(renderPath) + 1 == renderPathCount)
+                {
+                    printBenchmark();
+                    glfwSetWindowShouldClose(window, true);
+                }
+                else
+                {
+                    renderPath = static_cast<RenderPath>(static_cast<int>(renderPath) + 1);
+                }
+                // Nothing to measure without GL 4.3
+                if (renderPath == RenderPath::GpuDriven && !gpuDrivenSupported)
+                {
+                    printBenchmark();
+                    glfwSetWindowShouldClose(window, true);
+                }
+            }
+        }
+
+        if (lightBenchmark && !benchmark)
+        {
+            auto& result = lightBenchmarkResults[lightBenchmarkStep];
+            if (++benchmarkFrame > 10)
+            {
+                result.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                          submitBegin)
+                                    .count();
+                result.assignMs += clusterStats.assignMs - assignBegin;
+                result.gpuMs += gpuTimer.lastMs();
+                result.indices += clusterStats.indices - indicesBegin;
+                result.frames++;
+            }
+            if (benchmarkFrame == benchmarkFrames)
+            {
+                benchmarkFrame = 0;
+                if (++lightBenchmarkStep == lightBenchmarkSteps)
+                {
+                    printLightBenchmark();
+                    glfwSetWindowShouldClose(window, true);
+                }
+                else
+                {
+                    // The simulation respawns the lights from the next input it sees
+                    lightCount = lightBenchmarkCounts[lightBenchmarkStep];
+                }
+            }
+        }
+
+        if (threadBenchmark && !benchmark && !lightBenchmark)
+        {
+            auto& result = threadBenchmarkResults[threadBenchmarkStep];
+            if (++benchmarkFrame > 10)
+            {
+                const auto& queue = renderQueue.stats;
+                result.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                          submitBegin)
+                                    .count();
+                result.recordMs += queue.recordMs - queueBefore.recordMs;
+                result.encodeMs += queue.encodeMs - queueBefore.encodeMs;
+                result.replayMs += queue.replayMs - queueBefore.replayMs;
+                result.items += queue.items - queueBefore.items;
+                result.frames++;
+            }
+            if (benchmarkFrame == benchmarkFrames)
+            {
+                benchmarkFrame = 0;
+                // Stop at the pool size, more partitions than threads measure nothing new
+                if (++threadBenchmarkStep == threadBenchmarkSteps ||
+                    threadBenchmarkCounts[threadBenchmarkStep] > workers.size())
+                {
+                    printThreadBenchmark();
+                    glfwSetWindowShouldClose(window, true);
+                }
+            }
+        }
+
+        if (particleBenchmark && !benchmark && !lightBenchmark && !threadBenchmark)
+        {
+            auto& result = particleBenchmarkResults[particleBenchmarkStep / 2][particleBenchmarkStep % 2];
+            if (++benchmarkFrame > 10)
+            {
+                result.simulateMs += particleStats.simulateMs - particlesBefore.simulateMs;
+                result.drawMs += particleStats.drawMs - particlesBefore.drawMs;
+                result.frames++;
+            }
+            if (benchmarkFrame == benchmarkFrames)
+            {
+                benchmarkFrame = 0;
+                // Odd steps run on the GPU, skipped without GL 4.3
+                particleBenchmarkStep += ParticleSystem::gpuSupported() ? 1 : 2;
+                if (particleBenchmarkStep >= 2 * particleBenchmarkSteps)
+                {
+                    printParticleBenchmark();
+                    glfwSetWindowShouldClose(window, true);
+                }
+                else
+                {
+                    gpuParticles = particleBenchmarkStep % 2 == 1;
+                    particles->resize(particleBenchmarkCounts[particleBenchmarkStep / 2]);
+                }
+            }
+        }
+
+        if (glState.debug)
+        {
+            glState.validate();
+        }
 
         glfwSwapBuffers(window);
+        // Input is polled after the wait, the next frame starts from the freshest events
+        pacer->setFramesInFlight(framesInFlight);
+        pacer->endFrame();
         glfwPollEvents();
+
+        reportStats(currentFrame);
     }
 
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-    glDeleteVertexArrays(1, &VAO);
+    // The watcher's worker reads the watched shaders while it rebuilds, join it before any owner goes away
+    watcher.stop();
+    instances.clear();
+    gpuDriven.reset();
+    streamBuffer.reset();
+    overdraw.reset();
+    clusteredLights.reset();
+    shadowAtlas.reset();
+    sceneTarget.reset();
+    temporal.reset();
+    ambientOcclusion.reset();
+    renderGraph.reset();
+    particles.reset();
+    pacer.reset();
+    for (auto& batch : batches)
+    {
+        destroyMesh(batch.mesh);
+    }
+    destroyMesh(quad);
 
+    occlusion.reset();
     glfwTerminate();
     return 0;
 }
 
-void processInput(GLFWwindow* window)
+void reportStats(float currentFrame)
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    statsFrames++;
+    if (currentFrame - statsTime < 1.0f)
     {
-        glfwSetWindowShouldClose(window, true);
+        return;
     }
 
-    const float cameraSpeed = cameraVelocity * deltaTime;
+    const float frames = static_cast<float>(statsFrames);
+    const double aoFrames = std::max(ssaoStats.frames, 1ul);
+    const double aoMs = ssaoStats.downsampleMs + ssaoStats.occlusionMs + ssaoStats.blurMs + ssaoStats.upsampleMs;
+    const auto& queue = renderQueue.stats;
+    std::cout << frames / (currentFrame - statsTime) << " fps | draws/frame: " << queue.draws / frames
+              << " | state changes/frame: " << queue.programChanges / frames << " program, "
+              << queue.vertexArrayChanges / frames << " vao, " << queue.textureChanges / frames << " texture"
+              << " | queue: " << queue.items / frames << " items, sort " << queue.sortMs / frames << " ms, record "
+              << queue.recordMs / frames << " ms, encode " << queue.encodeMs / frames << " ms into "
+              << queue.commandBuffers / frames << " buffers, replay " << queue.replayMs / frames << " ms on "
+              << renderQueue.threads() << " threads"
+              << " | uniforms/frame: " << Shader::uniformStats.issued / frames << " issued, "
+              << Shader::uniformStats.skipped / frames << " skipped"
+              << " | culling/frame: " << cullingStats.visible / frames << " of " << cullingStats.tested / frames
+              << " visible in " << cullingStats.ms / frames << " ms, " << portalStats.cellsVisited / frames
+              << " cells, " << portalStats.portalsTested / frames << " portals"
+              << " | occlusion/frame: " << occlusionStats.occluded / frames << " occluded, "
+              << occlusionStats.visible / frames << " visible groups, " << occlusionStats.queries / frames
+              << " queries, " << queue.conditionalDraws / frames << " conditional draws"
+              << " | cpu occlusion/frame: " << softwareOcclusionStats.occluded / frames << " of "
+              << softwareOcclusionStats.tested / frames << " occluded, " << softwareOcclusionStats.triangles / frames
+              << " triangles, raster " << softwareOcclusionStats.rasterMs / frames << " ms, test "
+              << softwareOcclusionStats.testMs / frames << " ms"
+              << " | streamed/frame: " << streamStats.bytes / frames / 1024.0f << " KB in "
+              << streamStats.allocations / frames << " allocations, " << streamStats.fenceWaits
+              << " fence waits this second (" << streamStats.waitMs << " ms)"
+              << " | overdraw (" << depthModeNames[static_cast<int>(depthMode)]
+              << "): " << overdrawStats.shadedSamples / std::max(overdrawStats.pixels, 1.0) << " shaded per pixel"
+              << " | lights/frame: " << clusterStats.lights / frames << " lights, " << clusterStats.indices / frames
+              << " cluster entries, assign " << clusterStats.assignMs / frames << " ms"
+              << " | shadows/frame: " << shadowStats.shadowedLights / frames << " lights, "
+              << shadowStats.tilesRendered / frames << " tiles rendered, " << shadowStats.tilesCached / frames
+              << " cached, " << shadowStats.tilesDeferred / frames << " deferred, "
+              << shadowStats.tilesComposited / frames << " composited, " << shadowStats.ms / frames << " ms"
+              << " | resolution/frame: " << resolutionStats.scale / frames * 100.0 << "% scale, "
+              << resolutionStats.pixels / frames / 1000.0f << "k pixels, budget " << gpuBudgetMs << " ms, "
+              << resolutionStats.reallocations << " reallocations"
+              << " | temporal/frame: " << temporalStats.resolves / frames << " resolves, "
+              << temporalStats.historyResets << " history resets this second"
+              << " | ssao (" << aoModeNames[static_cast<int>(aoMode)]
+              << "): " << aoMs / aoFrames << " ms, downsample " << ssaoStats.downsampleMs / aoFrames << ", occlusion "
+              << ssaoStats.occlusionMs / aoFrames << ", blur " << ssaoStats.blurMs / aoFrames << ", upsample "
+              << ssaoStats.upsampleMs / aoFrames
+              << " | render graph/frame: " << renderGraphStats.passes / frames << " passes, "
+              << renderGraphStats.culled / frames << " culled, " << renderGraphStats.transients / frames
+              << " transients in " << renderGraphStats.allocations / frames << " textures, "
+              << renderGraphStats.requestedBytes / frames / (1024.0 * 1024.0) << " MB requested, "
+              << renderGraphStats.allocatedBytes / frames / (1024.0 * 1024.0) << " MB allocated, "
+              << renderGraphStats.reallocations << " reallocations"
+              << " | particles (" << (gpuParticles ? "gpu" : "cpu")
+              << "): " << particleStats.particles / frames << " particles/frame, simulate "
+              << particleStats.simulateMs / frames << " ms ("
+              << particleStats.particles / std::max(particleStats.simulateMs, 1e-6) << " particles/ms), draw "
+              << particleStats.drawMs / frames << " ms"
+              << " | simulation (" << (threadedSimulation ? "threaded" : "inline")
+              << "): " << simulationStats.steps / frames << " steps/frame, " << simulationStats.stepMs / frames
+              << " ms, " << simulationStats.overlapMs / std::max(simulationStats.stepMs, 1e-9) * 100.0
+              << "% overlapped with rendering, " << simulationStats.staleFrames << " stale frames this second"
+              << " | pacing (" << framesInFlight << " in flight, " << (lateInput ? "late" : "early")
+              << " input): " << pacingStats.fenceWaits << " fence waits this second (" << pacingStats.waitMs
+              << " ms), input to present " << pacingStats.latencyMs / std::max(pacingStats.measured, 1ul)
+              << " ms, max " << pacingStats.maxLatencyMs << " ms"
+              << " | mouse: " << mouseStats.events << " events in " << mouseStats.applies
+              << " applies this second, oldest waited " << mouseStats.waitMs / std::max(mouseStats.applies, 1ul)
+              << " ms, max " << mouseStats.maxWaitMs << " ms, " << mouseStats.spilled << " spilled"
+              << " | gl state calls/frame: " << glState.stats.issued / frames << " issued, "
+              << glState.stats.elided / frames << " elided" << std::endl;
+
+    Shader::uniformStats = {};
+    renderQueue.stats = {};
+    glState.stats = {};
+    cullingStats = {};
+    portalStats = {};
+    occlusionStats = {};
+    softwareOcclusionStats = {};
+    streamStats = {};
+    overdrawStats = {};
+    clusterStats = {};
+    shadowStats = {};
+    resolutionStats = {};
+    temporalStats = {};
+    ssaoStats = {};
+    renderGraphStats = {};
+    simulationStats = {};
+    particleStats = {};
+    pacingStats = {};
+    mouseStats = {};
+    statsFrames = 0;
+    statsTime = currentFrame;
+}
 
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+void printBenchmark()
+{
+    std::cout << "benchmark: " << corridorSegments << " segments, " << benchmarkFrames << " frames per path, "
+              << depthModeNames[static_cast<int>(depthMode)] << "\n"
+              << "path            draws/frame   cpu ms/frame   gpu ms/frame   overdraw" << std::endl;
+    for (int i = 0; i < renderPathCount; i++)
     {
-        if (!jumping && cameraPos.y == cameraPosY)
+        const auto& result = benchmarkResults[i];
+        if (!result.frames)
         {
-            jumping = true;
+            std::printf("%-15s not supported\n", renderPathNames[i]);
+            continue;
         }
-
-        return;
+        const double frames = std::max(result.frames, 1);
+        std::printf("%-15s %11.1f %14.3f %14.3f %10.2f\n", renderPathNames[i], result.draws / frames,
+                    result.cpuMs / frames, result.gpuMs / frames, result.overdraw / frames);
     }
+}
 
-    // Disable other key checks while jumping/falling
-    if (jumping || (!jumping && cameraPos.y > cameraPosY))
+void printLightBenchmark()
+{
+    std::cout << "light benchmark: " << renderPathNames[static_cast<int>(renderPath)] << ", " << corridorSegments
+              << " segments, " << benchmarkFrames << " frames per count\n"
+              << "lights   cluster entries   assign ms   cpu ms/frame   gpu ms/frame" << std::endl;
+    for (int i = 0; i < lightBenchmarkSteps; i++)
     {
-        return;
+        const auto& result = lightBenchmarkResults[i];
+        const double frames = std::max(result.frames, 1);
+        std::printf("%-8d %15.0f %11.3f %14.3f %14.3f\n", lightBenchmarkCounts[i], result.indices / frames,
+                    result.assignMs / frames, result.cpuMs / frames, result.gpuMs / frames);
     }
+}
 
-    // Moving forward
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-    {
-        cameraPos += cameraSpeed * cameraFront;
-    }
-    // Moving backward
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-    {
-        cameraPos -= cameraSpeed * cameraFront;
-    }
-    // Moving through negative x-axis
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+void printThreadBenchmark()
+{
+    std::cout << "thread benchmark: " << renderPathNames[static_cast<int>(renderPath)] << ", " << corridorSegments
+              << " segments, " << benchmarkFrames << " frames per thread count\n"
+              << "threads   items/frame   record ms   encode ms   replay ms   cpu ms/frame" << std::endl;
+    for (int i = 0; i < threadBenchmarkSteps; i++)
     {
-        auto cameraRight = cameraFront.cross(cameraUp).normalize();
-        cameraPos -= cameraRight * cameraSpeed;
+        const auto& result = threadBenchmarkResults[i];
+        if (!result.frames)
+        {
+            continue;
+        }
+        const double frames = result.frames;
+        std::printf("%-9u %11.0f %11.3f %11.3f %11.3f %14.3f\n", threadBenchmarkCounts[i], result.items / frames,
+                    result.recordMs / frames, result.encodeMs / frames, result.replayMs / frames,
+                    result.cpuMs / frames);
     }
-    // Moving through positive x-axis
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+}
+
+void printParticleBenchmark()
+{
+    std::cout << "particle benchmark: " << benchmarkFrames << " frames per count and path\n"
+              << "particles   cpu ms   cpu particles/ms   gpu ms   gpu particles/ms   draw ms" << std::endl;
+    for (int i = 0; i < particleBenchmarkSteps; i++)
     {
-        auto cameraRight = cameraFront.cross(cameraUp).normalize();
-        cameraPos += cameraRight * cameraSpeed;
+        const auto& cpu = particleBenchmarkResults[i][0];
+        const auto& gpu = particleBenchmarkResults[i][1];
+        const double count = particleBenchmarkCounts[i];
+        const double cpuMs = cpu.simulateMs / std::max(cpu.frames, 1);
+        std::printf("%-11u %6.3f %18.0f", particleBenchmarkCounts[i], cpuMs, count / std::max(cpuMs, 1e-6));
+        if (!gpu.frames)
+        {
+            std::printf(" %8s %18s %9.3f\n", "n/a", "n/a", cpu.drawMs / std::max(cpu.frames, 1));
+            continue;
+        }
+        const double gpuMs = gpu.simulateMs / gpu.frames;
+        std::printf(" %8.3f %18.0f %9.3f\n", gpuMs, count / std::max(gpuMs, 1e-6), gpu.drawMs / gpu.frames);
     }
-    cameraPos.y = cameraPosY;
 }
 
-void mouseCallback(GLFWwindow* window, double xposIn, double yposIn)
+SimulationInput sampleInput(GLFWwindow* window)
 {
-    float xpos = static_cast<float>(xposIn);
-    float ypos = static_cast<float>(yposIn);
-
-    if (firstMouse)
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
     {
-        lastX = xpos;
-        lastY = ypos;
-        firstMouse = false;
+        glfwSetWindowShouldClose(window, true);
     }
 
-    float xoffset = xpos - lastX;
-    float yoffset = lastY - ypos;  // reversed since y-coordinates go from bottom to top
-    lastX = xpos;
-    lastY = ypos;
-
-    float sensitivity = 0.17f;  // change this value to your liking
-    xoffset *= sensitivity;
-    yoffset *= sensitivity;
-
-    yaw += xoffset;
-    pitch += yoffset;
-
-    // make sure that when pitch is out of bounds, screen doesn't get flipped
-    if (pitch > 89.0f)
-        pitch = 89.0f;
-    if (pitch < -89.0f)
-        pitch = -89.0f;
-
-    vec3 dir{};
-    dir.x = cos(radians(yaw)) * cos(radians(pitch));
-    dir.y = sin(radians(pitch));
-    dir.z = sin(radians(yaw)) * cos(radians(pitch));
-    cameraFront = dir.normalize();
+    SimulationInput input;
+    input.sampled = std::chrono::steady_clock::now();
+    input.deltaTime = deltaTime;
+    input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+    input.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+    input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+    input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+    input.jump = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+    input.yaw = yaw;
+    input.pitch = pitch;
+    input.fov = fov;
+    input.animateLights = animateLights;
+    input.lightCount = lightCount;
+    return input;
+}
+
+void mouseCallback(GLFWwindow* window, double xposIn, double yposIn)
+{
+    // Runs inside glfwPollEvents, the motion is only queued until the frame applies it
+    mouseInput.push(xposIn, yposIn);
 }
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
@@ -369,13 +1248,102 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
         fov = 45.0f;
 }
 
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+        pendingKeys.push_back(key);
+}
+
+// Settings read all over the frame only change between frames
+void applyWindowEvents()
+{
+    if (resizePending)
+    {
+        // make sure the viewport matches the new window dimensions; note that width and
+        // height will be significantly larger than specified on retina displays.
+        screenWidth = pendingWidth;
+        screenHeight = pendingHeight;
+        glState.viewport(0, 0, screenWidth, screenHeight);
+        resizePending = false;
+    }
+    for (const int key : pendingKeys)
+    {
+        handleKey(key);
+    }
+    pendingKeys.clear();
+}
+
+void handleKey(int key)
+{
+    // 1-4 switch the render path so they can be compared on the same scene
+    if (key == GLFW_KEY_1)
+        renderPath = RenderPath::PerObject;
+    if (key == GLFW_KEY_2)
+        renderPath = RenderPath::Instanced;
+    if (key == GLFW_KEY_3)
+        renderPath = RenderPath::StaticBatch;
+    if (key == GLFW_KEY_4 && gpuDrivenSupported)
+        renderPath = RenderPath::GpuDriven;
+    // C toggles frustum culling, P the portal walk that takes precedence over it
+    if (key == GLFW_KEY_C)
+        frustumCulling = !frustumCulling;
+    if (key == GLFW_KEY_P)
+        portalCulling = !portalCulling;
+    // O toggles hardware occlusion queries, H the CPU Hi-Z rasterizer
+    if (key == GLFW_KEY_O)
+        occlusionCulling = !occlusionCulling;
+    if (key == GLFW_KEY_H)
+        softwareOcclusionCulling = !softwareOcclusionCulling;
+    // Z cycles the opaque depth ordering, V shows overdraw as a heat map
+    if (key == GLFW_KEY_Z)
+        depthMode = static_cast<DepthMode>((static_cast<int>(depthMode) + 1) % depthModeCount);
+    if (key == GLFW_KEY_V)
+        visualizeOverdraw = !visualizeOverdraw;
+    // L switches between clustered point lights and the unlit textures
+    if (key == GLFW_KEY_L)
+        clusteredLighting = !clusteredLighting;
+    // G toggles shadows, F freezes the lights so cached shadow maps stay valid
+    if (key == GLFW_KEY_G)
+        shadowsEnabled = !shadowsEnabled;
+    if (key == GLFW_KEY_F)
+        animateLights = !animateLights;
+    // R toggles dynamic resolution, U sharpening in the plain upscale, T temporal upsampling
+    if (key == GLFW_KEY_R)
+        dynamicResolution = !dynamicResolution;
+    if (key == GLFW_KEY_U)
+        sharpenUpscale = !sharpenUpscale;
+    if (key == GLFW_KEY_T)
+        temporalUpsampling = !temporalUpsampling;
+    // K cycles ambient occlusion off, half and quarter resolution, J toggles its temporal accumulation
+    if (key == GLFW_KEY_K)
+        aoMode = static_cast<AoMode>((static_cast<int>(aoMode) + 1) % aoModeCount);
+    if (key == GLFW_KEY_J)
+        aoAccumulation = !aoAccumulation;
+    if (key == GLFW_KEY_X)
+        dumpGraph = true;
+    // M moves draw recording and command encoding between the worker threads and the GL thread
+    if (key == GLFW_KEY_M)
+        multithreadedRecording = !multithreadedRecording;
+    // E toggles the particles, B moves their simulation between the compute shader and the worker threads
+    if (key == GLFW_KEY_E)
+        particlesEnabled = !particlesEnabled;
+    if (key == GLFW_KEY_B)
+        gpuParticles = !gpuParticles && ParticleSystem::gpuSupported();
+    // Q moves the simulation between its own thread and the render thread
+    if (key == GLFW_KEY_Q)
+        threadedSimulation = !threadedSimulation;
+    // I cycles the frames in flight, Y toggles late input
+    if (key == GLFW_KEY_I)
+        framesInFlight = framesInFlight % FramePacer::maxFramesInFlight + 1;
+    if (key == GLFW_KEY_Y)
+        lateInput = !lateInput;
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 {
-    // make sure the viewport matches the new window dimensions; note that width and
-    // height will be significantly larger than specified on retina displays.
-    screenWidth = width;
-    screenHeight = height;
-    glViewport(0, 0, width, height);
+    pendingWidth = width;
+    pendingHeight = height;
+    resizePending = true;
 }
@@ -110,6 +110,7 @@ struct vec4
     vec4 operator*(const vec4 &rhs) const;
 
     vec4 operator+(const vec4 &rhs) const;
+    vec4 operator-(const vec4 &rhs) const;
     
     bool operator==(const vec4 &rhs) const;
 
@@ -212,6 +213,8 @@ inline vec4 vec4::operator*(const vec4 &rhs) const { return vec4{x * rhs.x, y *
 
 inline vec4 vec4::operator+(const vec4 &rhs) const { return vec4{x + rhs.x, y + rhs.y, z + rhs.z, w + rhs.w}; }
 
+inline vec4 vec4::operator-(const vec4 &rhs) const { return vec4{x - rhs.x, y - rhs.y, z - rhs.z, w - rhs.w}; }
+
 inline bool vec4::operator==(const vec4 &rhs) const 
 {
     return x == rhs.x && y == rhs.y && z == rhs.z && w == rhs.w;
@@ -275,6 +278,8 @@ struct mat4
         return m;
     }
 
+    vec4 operator*(const vec4 &v) const { return v.x * col0 + v.y * col1 + v.z * col2 + v.w * col3; }
+
     vec4 col0;
     vec4 col1;
     vec4 col2;
@@ -365,6 +370,19 @@ inline mat4 lookAt(const vec3 &eye, const vec3 &target, const vec3 &worldUp)
     return lookAtm;
 }
 
+// Inverse of a rotation plus translation, e.g. a lookAt() view matrix. The rotation is orthonormal, its inverse is
+// its transpose.
+inline mat4 inverseRigid(const mat4 &m)
+{
+    mat4 inv{1.0f};
+    for (int c = 0; c < 3; c++)
+        for (int r = 0; r < 3; r++)
+            inv[c][r] = m[r][c];
+    for (int r = 0; r < 3; r++)
+        inv[3][r] = -(m[r][0] * m[3][0] + m[r][1] * m[3][1] + m[r][2] * m[3][2]);
+    return inv;
+}
+
 inline mat4 scale(const mat4 &m, const vec3 &v)
 {
     mat4 s{};
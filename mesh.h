@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "gl_state.h"
+
+// Interleaved position + texture coordinate layout shared by every mesh.
+struct Vertex
+{
+    float x, y, z;
+    float u, v;
+};
+
+struct Mesh
+{
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+    GLuint EBO = 0;
+    GLsizei indexCount = 0;
+};
+
+// Point attributes 0 (position) and 1 (texture coords) of the bound VAO at the bound GL_ARRAY_BUFFER.
+inline void setupVertexAttributes()
+{
+    // Position attribute
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    // Texture coord attribute
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
+
+inline Mesh createMesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                       GLenum usage = GL_STATIC_DRAW)
+{
+    Mesh mesh;
+    mesh.indexCount = static_cast<GLsizei>(indices.size());
+
+    glGenVertexArrays(1, &mesh.VAO);
+    glGenBuffers(1, &mesh.VBO);
+    glGenBuffers(1, &mesh.EBO);
+
+    glState.bindVertexArray(mesh.VAO);
+
+    glState.bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), usage);
+
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), usage);
+
+    setupVertexAttributes();
+    glState.bindVertexArray(0);
+    return mesh;
+}
+
+inline void destroyMesh(Mesh& mesh)
+{
+    glState.forgetBuffer(mesh.VBO);
+    glState.forgetBuffer(mesh.EBO);
+    glState.forgetVertexArray(mesh.VAO);
+    glDeleteBuffers(1, &mesh.VBO);
+    glDeleteBuffers(1, &mesh.EBO);
+    glDeleteVertexArrays(1, &mesh.VAO);
+    mesh = {};
+}
+
+// Unit quad in the XY plane centered at the origin, every corridor surface is one of these.
+inline const std::vector<Vertex> quadVertices = {
+    // positions          // texture coords
+    {0.5f, 0.5f, 0.0f, 1.0f, 1.0f},    // top right
+    {0.5f, -0.5f, 0.0f, 1.0f, 0.0f},   // bottom right
+    {-0.5f, -0.5f, 0.0f, 0.0f, 0.0f},  // bottom left
+    {-0.5f, 0.5f, 0.0f, 0.0f, 1.0f}    // top left
+};
+
+inline const std::vector<unsigned int> quadIndices = {
+    0, 1, 3,  // first Triangle
+    1, 2, 3   // second Triangle
+};
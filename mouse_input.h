@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+struct MouseStats
+{
+    unsigned long events = 0;
+    // Frames that applied at least one event
+    unsigned long applies = 0;
+    // Events folded into a later one because the queue was full
+    unsigned long spilled = 0;
+    // Age of the oldest event in each apply, how long motion waited to turn the camera
+    double waitMs = 0.0;
+    double maxWaitMs = 0.0;
+};
+
+inline MouseStats mouseStats;
+
+// Cursor motion between frames. GLFW reports absolute positions from inside glfwPollEvents, the callback only turns
+// them into timestamped deltas on a single-producer single-consumer ring. Once per frame, right before the view matrix
+// is built, apply() sums whatever arrived into yaw and pitch, so the camera turns once with all of it instead of once
+// per event, and the orientation a frame shows is as new as the last poll.
+//
+// The ring is lock-free: push() only writes the tail and apply() only the head, so the producer could just as well
+// be an input thread. A full ring never drops motion, the overflow waits in a spill delta that rides along with the
+// next push.
+class MouseInput
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr float sensitivity = 0.17f;
+    // Past straight up or down the view flips
+    static constexpr float pitchLimit = 89.0f;
+
+    // Producer side, from the cursor position callback
+    void push(double xpos, double ypos)
+    {
+        const auto now = clock::now();
+        if (!tracking)
+        {
+            // The first position only sets the origin, the cursor may start anywhere
+            lastX = xpos;
+            lastY = ypos;
+            tracking = true;
+            return;
+        }
+        // Reversed y, window coordinates grow downwards
+        Delta delta{static_cast<float>(xpos - lastX), static_cast<float>(lastY - ypos), now};
+        lastX = xpos;
+        lastY = ypos;
+        mouseStats.events++;
+
+        if (spilled)
+        {
+            delta.x += spill.x;
+            delta.y += spill.y;
+            delta.time = spill.time;
+        }
+        const unsigned int tail = write.load(std::memory_order_relaxed);
+        if (tail - read.load(std::memory_order_acquire) == capacity)
+        {
+            if (!spilled)
+                spill.time = delta.time;
+            spill.x = delta.x;
+            spill.y = delta.y;
+            spilled = true;
+            mouseStats.spilled++;
+            return;
+        }
+        ring[tail % capacity] = delta;
+        write.store(tail + 1, std::memory_order_release);
+        spilled = false;
+    }
+
+    // Consumer side, once per frame. Adds everything queued since the last call to yaw and pitch in degrees, false
+    // when the mouse did not move. Pitch is clamped once on the sum rather than after every event.
+    bool apply(float& yaw, float& pitch)
+    {
+        const unsigned int head = read.load(std::memory_order_relaxed);
+        const unsigned int tail = write.load(std::memory_order_acquire);
+        if (head == tail)
+        {
+            return false;
+        }
+        float x = 0.0f;
+        float y = 0.0f;
+        for (unsigned int i = head; i != tail; i++)
+        {
+            x += ring[i % capacity].x;
+            y += ring[i % capacity].y;
+        }
+        const auto oldest = ring[head % capacity].time;
+        read.store(tail, std::memory_order_release);
+
+        yaw += x * sensitivity;
+        pitch = std::clamp(pitch + y * sensitivity, -pitchLimit, pitchLimit);
+
+        const double waitMs = std::chrono::duration<double, std::milli>(clock::now() - oldest).count();
+        mouseStats.applies++;
+        mouseStats.waitMs += waitMs;
+        mouseStats.maxWaitMs = std::max(mouseStats.maxWaitMs, waitMs);
+        return true;
+    }
+
+private:
+    // Enough for an 8 kHz mouse at 30 fps
+    static constexpr unsigned int capacity = 512;
+
+    struct Delta
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        clock::time_point time;
+    };
+
+    Delta ring[capacity];
+    std::atomic<unsigned int> write{0};
+    std::atomic<unsigned int> read{0};
+
+    // Producer only
+    double lastX = 0.0;
+    double lastY = 0.0;
+    bool tracking = false;
+    Delta spill;
+    bool spilled = false;
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <vector>
+
+#include "culling.h"
+#include "gl_ext.h"
+#include "gl_state.h"
+#include "math.h"
+#include "mesh.h"
+#include "shader.h"
+
+struct OcclusionStats
+{
+    unsigned long queries = 0;
+    unsigned long occluded = 0;
+    unsigned long visible = 0;
+};
+
+inline OcclusionStats occlusionStats;
+
+// Hardware occlusion culling for groups of renderables. After the frame's draws the bounding box of every group in
+// the frustum is rendered without colour or depth writes inside an any-samples-passed query. Results are polled at
+// the start of the next frame and only read once available, so the CPU never waits on the GPU.
+//
+// A group is hidden on the CPU only after hideAfter consecutive occluded results, a single visible result shows it
+// again. Inside that window its draws are wrapped in conditional rendering on the newest query, so the GPU can
+// already skip them if the box is still hidden.
+class OcclusionCuller
+{
+public:
+    static constexpr int hideAfter = 4;
+
+    OcclusionCuller(const std::vector<Bounds>& groupBounds) : groups(groupBounds.size())
+    {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            groups[i].bounds = groupBounds[i];
+            glGenQueries(2, groups[i].queries);
+        }
+        box = createMesh(boxVertices, boxIndices);
+
+        // The conservative variant lets the driver answer from coarse depth, the exact one is core since 3.3
+        queryTarget = glVersionAtLeast(4, 3) || hasExtension("GL_ARB_ES3_compatibility")
+                          ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+                          : GL_ANY_SAMPLES_PASSED;
+    }
+
+    ~OcclusionCuller()
+    {
+        for (auto& group : groups)
+            glDeleteQueries(2, group.queries);
+        destroyMesh(box);
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    Shader& shader() { return boxShader; }
+
+    // Read whatever results have arrived since the last frame and update each group's state. Call once per frame
+    // before recording draws.
+    void update()
+    {
+        for (auto& group : groups)
+        {
+            // Oldest first, so a newer result always wins
+            for (int n = 0; n < 2; n++)
+            {
+                const int slot = (group.next + n) % 2;
+                if (!group.pending[slot])
+                {
+                    continue;
+                }
+                GLint available = 0;
+                glGetQueryObjectiv(group.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                {
+                    continue;
+                }
+                GLuint samples = 0;
+                glGetQueryObjectuiv(group.queries[slot], GL_QUERY_RESULT, &samples);
+                group.pending[slot] = false;
+                group.occludedResults = samples ? 0 : group.occludedResults + 1;
+            }
+
+            if (group.occluded())
+                occlusionStats.occluded++;
+            else
+                occlusionStats.visible++;
+        }
+    }
+
+    // Whether the group's draws can be skipped outright
+    bool isOccluded(int group) const { return group >= 0 && groups[group].occluded(); }
+
+    // Query to wrap the group's draws in, 0 to draw unconditionally. Only groups whose last result was occluded
+    // but that are still inside the hysteresis window get one, steadily visible groups never wait on a query.
+    GLuint conditionQuery(int group) const
+    {
+        if (group < 0)
+        {
+            return 0;
+        }
+        const auto& g = groups[group];
+        const int newest = (g.next + 1) % 2;
+        return g.occludedResults > 0 && g.pending[newest] ? g.queries[newest] : 0;
+    }
+
+    // Test every group box against the depth buffer of the frame just drawn. Groups outside the frustum or around
+    // the camera are not queried, their state resets to visible so they never pop in a frame late.
+    void issueQueries(const mat4& viewProj, const Frustum& frustum, const vec3& eye, float nearPlane)
+    {
+        boxShader.setMat4("viewProj", viewProj);
+        boxShader.use();
+        glState.bindVertexArray(box.VAO);
+        glState.colorMask(false);
+        glState.depthMask(false);
+
+        for (auto& group : groups)
+        {
+            if (!isVisible(frustum, group.bounds) || contains(group.bounds, eye, nearPlane * 2.0f))
+            {
+                group.occludedResults = 0;
+                continue;
+            }
+            // Both queries still in flight, skip a frame rather than overwrite an unread result
+            if (group.pending[group.next])
+            {
+                continue;
+            }
+
+            // Grown slightly so surfaces lying on the box faces are not z-fighting against it
+            boxShader.setVec3(centerUniform, group.bounds.center);
+            boxShader.setVec3(extentsUniform, group.bounds.extents + vec3{boxMargin});
+            glBeginQuery(queryTarget, group.queries[group.next]);
+            glDrawElements(GL_TRIANGLES, box.indexCount, GL_UNSIGNED_INT, 0);
+            glEndQuery(queryTarget);
+
+            group.pending[group.next] = true;
+            group.next = (group.next + 1) % 2;
+            occlusionStats.queries++;
+        }
+
+        glState.depthMask(true);
+        glState.colorMask(true);
+    }
+
+    // Show every group again, called while occlusion culling is off so it resumes from a clean state
+    void reset()
+    {
+        for (auto& group : groups)
+            group.occludedResults = 0;
+    }
+
+    size_t groupCount() const { return groups.size(); }
+
+private:
+    struct Group
+    {
+        Bounds bounds;
+        GLuint queries[2] = {};
+        bool pending[2] = {};
+        int next = 0;
+        int occludedResults = 0;
+
+        bool occluded() const { return occludedResults >= hideAfter; }
+    };
+
+    static constexpr float boxMargin = 0.05f;
+
+    static bool contains(const Bounds& b, const vec3& p, float margin)
+    {
+        return std::fabs(p.x - b.center.x) <= b.extents.x + margin &&
+               std::fabs(p.y - b.center.y) <= b.extents.y + margin &&
+               std::fabs(p.z - b.center.z) <= b.extents.z + margin;
+    }
+
+    inline static const std::vector<Vertex> boxVertices = {
+        {-1.0f, -1.0f, -1.0f, 0.0f, 0.0f}, {1.0f, -1.0f, -1.0f, 0.0f, 0.0f},
+        {1.0f, 1.0f, -1.0f, 0.0f, 0.0f},   {-1.0f, 1.0f, -1.0f, 0.0f, 0.0f},
+        {-1.0f, -1.0f, 1.0f, 0.0f, 0.0f},  {1.0f, -1.0f, 1.0f, 0.0f, 0.0f},
+        {1.0f, 1.0f, 1.0f, 0.0f, 0.0f},    {-1.0f, 1.0f, 1.0f, 0.0f, 0.0f},
+    };
+
+    inline static const std::vector<unsigned int> boxIndices = {
+        0, 2, 1, 0, 3, 2,  // back
+        4, 5, 6, 4, 6, 7,  // front
+        0, 4, 7, 0, 7, 3,  // left
+        1, 2, 6, 1, 6, 5,  // right
+        0, 1, 5, 0, 5, 4,  // bottom
+        3, 7, 6, 3, 6, 2   // top
+    };
+
+    std::vector<Group> groups;
+    Shader boxShader{"occlusion_box.vert", "occlusion_box.frag"};
+    // Set once per queried group
+    Shader::UniformSlot centerUniform = boxShader.uniform("center");
+    Shader::UniformSlot extentsUniform = boxShader.uniform("extents");
+    Mesh box;
+    GLenum queryTarget = GL_ANY_SAMPLES_PASSED;
+};
+
+// Occlusion group of every renderable: the group whose box holds its center, or -1 for surfaces much larger than a
+// group (floor, ceiling) which are always drawn. Group boxes grow to enclose their members, a hidden box must mean
+// hidden members.
+inline std::vector<int> assignOcclusionGroups(std::vector<Bounds>& groups, const std::vector<Bounds>& bounds)
+{
+    const auto inside = [](const Bounds& outer, const vec3& p)
+    {
+        return std::fabs(p.x - outer.center.x) <= outer.extents.x &&
+               std::fabs(p.y - outer.center.y) <= outer.extents.y &&
+               std::fabs(p.z - outer.center.z) <= outer.extents.z;
+    };
+    const auto fits = [](const Bounds& outer, const Bounds& inner)
+    {
+        const float slack = 1.5f;
+        return inner.extents.x <= outer.extents.x * slack && inner.extents.y <= outer.extents.y * slack &&
+               inner.extents.z <= outer.extents.z * slack;
+    };
+
+    std::vector<int> groupOf(bounds.size(), -1);
+    std::vector<Bounds> grown = groups;
+    for (size_t r = 0; r < bounds.size(); r++)
+    {
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            if (!inside(groups[g], bounds[r].center) || !fits(groups[g], bounds[r]))
+            {
+                continue;
+            }
+            groupOf[r] = static_cast<int>(g);
+
+            auto& box = grown[g];
+            const vec3 lo{std::fmin(box.center.x - box.extents.x, bounds[r].center.x - bounds[r].extents.x),
+                          std::fmin(box.center.y - box.extents.y, bounds[r].center.y - bounds[r].extents.y),
+                          std::fmin(box.center.z - box.extents.z, bounds[r].center.z - bounds[r].extents.z)};
+            const vec3 hi{std::fmax(box.center.x + box.extents.x, bounds[r].center.x + bounds[r].extents.x),
+                          std::fmax(box.center.y + box.extents.y, bounds[r].center.y + bounds[r].extents.y),
+                          std::fmax(box.center.z + box.extents.z, bounds[r].center.z + bounds[r].extents.z)};
+            box = {(lo + hi) * 0.5f, (hi - lo) * 0.5f};
+            break;
+        }
+    }
+    groups = grown;
+    return groupOf;
+}
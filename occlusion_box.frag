@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth-only, the occlusion query just counts samples passing the depth test.
+void main()
+{
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProj;
+uniform vec3 center;
+uniform vec3 extents;
+
+void main()
+{
+    gl_Position = viewProj * vec4(center + aPos * extents, 1.0);
+}
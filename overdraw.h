@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "shader.h"
+
+struct OverdrawStats
+{
+    double shadedSamples = 0.0;
+    double pixels = 0.0;
+};
+
+inline OverdrawStats overdrawStats;
+
+// Counts the fragments the opaque pass shades, divided by the screen size that is its overdraw: 1.0 means every
+// pixel was shaded exactly once. A GL_SAMPLES_PASSED query wraps the pass and is read a few frames late from a
+// small ring, like GpuTimer, so the count costs no stall. Samples-passed queries cannot overlap occlusion queries.
+//
+// With visualize on, the pass also increments the stencil buffer for every shaded fragment and draw() turns the
+// stencil counts into a heat map over the frame: blue once, green twice, yellow three times, red four or more.
+// The scene target's stencil has to be cleared every frame for that.
+class OverdrawMeter
+{
+public:
+    static constexpr int levels = 4;
+
+    OverdrawMeter()
+    {
+        glGenQueries(queryCount, queries);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~OverdrawMeter()
+    {
+        glState.forgetVertexArray(emptyVAO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteQueries(queryCount, queries);
+    }
+
+    OverdrawMeter(const OverdrawMeter&) = delete;
+    OverdrawMeter& operator=(const OverdrawMeter&) = delete;
+
+    Shader& shader() { return heatShader; }
+
+    void begin(bool visualizeOverdraw, int pixels)
+    {
+        visualize = visualizeOverdraw;
+        const int index = frame % queryCount;
+        if (frame >= queryCount)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint samples = 0;
+                glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT, &samples);
+                overdrawStats.shadedSamples += samples;
+                overdrawStats.pixels += queryPixels[index];
+                last = queryPixels[index] ? static_cast<float>(samples) / queryPixels[index] : 0.0f;
+            }
+        }
+        queryPixels[index] = pixels;
+        glBeginQuery(GL_SAMPLES_PASSED, queries[index]);
+
+        if (visualize)
+        {
+            glState.enable(GL_STENCIL_TEST);
+            glStencilFunc(GL_ALWAYS, 0, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        }
+    }
+
+    void end()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        frame++;
+        if (visualize)
+            glState.disable(GL_STENCIL_TEST);
+    }
+
+    // Most recent completed measurement in shaded fragments per pixel
+    float lastOverdraw() const { return last; }
+
+    // Heat map of the stencil counts the pass left behind, one fullscreen triangle per level
+    void draw()
+    {
+        if (!visualize)
+        {
+            return;
+        }
+        static const float colors[levels][3] = {
+            {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}};
+
+        glState.disable(GL_DEPTH_TEST);
+        glState.enable(GL_STENCIL_TEST);
+        glState.colorMask(true);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        heatShader.use();
+        glState.bindVertexArray(emptyVAO);
+        for (int level = 1; level <= levels; level++)
+        {
+            // The last level also takes everything above it
+            glStencilFunc(level == levels ? GL_LEQUAL : GL_EQUAL, level, 0xFF);
+            heatShader.setVec3("color", vec3{colors[level - 1][0], colors[level - 1][1], colors[level - 1][2]});
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glState.disable(GL_STENCIL_TEST);
+        glState.enable(GL_DEPTH_TEST);
+    }
+
+private:
+    static constexpr int queryCount = 4;
+
+    GLuint queries[queryCount];
+    int queryPixels[queryCount] = {};
+    int frame = 0;
+    float last = 0.0f;
+    bool visualize = false;
+    Shader heatShader{"fullscreen.vert", "overdraw.frag"};
+    GLuint emptyVAO = 0;
+};
@@ -0,0 +1,18 @@
+#version 330 core
+
+in vec2 TexCoord;
+in vec3 Color;
+flat in int Material;
+
+out vec4 FragColor;
+
+uniform sampler2D textures[2];
+
+// Additive, a round soft sprite broken up by the material's texture
+void main()
+{
+    vec2 offset = TexCoord * 2.0 - 1.0;
+    float mask = max(1.0 - dot(offset, offset), 0.0);
+    vec3 albedo = Material == 0 ? texture(textures[0], TexCoord).rgb : texture(textures[1], TexCoord).rgb;
+    FragColor = vec4(Color * albedo * mask * mask, 0.0);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+
+// Per instance, ParticleSystem's position buffer
+layout (location = 0) in vec4 aParticle;  // xyz, age as a fraction of the lifetime
+
+out vec2 TexCoord;
+out vec3 Color;
+flat out int Material;
+
+const int maxEmitters = 8;
+
+uniform int emitterCount;
+uniform int emitterEnd[maxEmitters];
+uniform vec4 emitterLook[maxEmitters];  // colour, size
+uniform int emitterMaterial[maxEmitters];
+uniform mat4 proj;
+uniform mat4 view;
+
+void main()
+{
+    int emitter = 0;
+    while (emitter < emitterCount - 1 && gl_InstanceID >= emitterEnd[emitter])
+        emitter++;
+
+    // A four vertex strip, the corner is offset in view space so the quad always faces the camera
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    float age = aParticle.w;
+    vec4 viewPos = view * vec4(aParticle.xyz, 1.0);
+    viewPos.xy += corner * emitterLook[emitter].w * (1.0 - 0.5 * age);
+    gl_Position = proj * viewPos;
+
+    TexCoord = corner * 0.5 + 0.5;
+    // Fade in over the first few percent of the life and out over the rest
+    Color = emitterLook[emitter].rgb * smoothstep(0.0, 0.05, age) * (1.0 - age);
+    Material = emitterMaterial[emitter];
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "gl_ext.h"
+#include "gl_state.h"
+#include "gpu_timer.h"
+#include "math.h"
+#include "scene.h"
+#include "shader.h"
+#include "thread_pool.h"
+
+struct ParticleStats
+{
+    unsigned long particles = 0;
+    double simulateMs = 0.0;
+    double drawMs = 0.0;
+    unsigned long frames = 0;
+};
+
+inline ParticleStats particleStats;
+
+// A source of particles. Every emitter owns a fixed share of the system's particles and a particle that dies is
+// born again from the same emitter straight away, so the emission rate is the share over the mean lifetime.
+struct ParticleEmitter
+{
+    vec3 center;
+    vec3 extents;  // particles are born anywhere in this box
+    vec3 velocity;
+    vec3 spread;  // added to the velocity, uniform in [-spread, spread] per axis
+    float gravity = 0.0f;
+    float drag = 0.0f;
+    float minLife = 1.0f;
+    float maxLife = 1.0f;
+    float size = 0.02f;
+    vec3 color{1.0f};
+    Material material = MaterialWall;
+    float share = 1.0f;  // relative to the other emitters
+};
+
+enum class ParticlePath
+{
+    Cpu,  // structure of arrays on the worker threads, 8 particles per instruction with AVX
+    Gpu   // compute shader over the same arrays in GPU buffers, GL 4.3 only
+};
+
+// PCG hash, particles.comp has the same one. Stateless, a particle's numbers only depend on its index and the frame,
+// so any thread can respawn any particle and both paths draw the same numbers.
+inline uint32_t particleHash(uint32_t x)
+{
+    const uint32_t state = x * 747796405u + 2891336453u;
+    const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Dust and sparks. Particles live in two streams, position with the age as a fraction of the lifetime and velocity
+// with the lifetime in seconds. On the GPU both are shader storage buffers a compute shader integrates in place,
+// on the CPU they are eight float arrays integrated in parallel chunks, written straight into the mapped position
+// buffer. Either way the position buffer is the per-instance attribute of one instanced draw of camera-facing
+// quads, blended additively over the scene without writing depth.
+class ParticleSystem
+{
+public:
+    static constexpr int maxEmitters = 8;
+
+    enum Pass
+    {
+        Simulate,
+        Draw,
+        PassCount
+    };
+
+    static bool gpuSupported() { return glExt.computeAndIndirect; }
+
+    // Particles bounce off the floor plane at floorY, nothing else collides
+    ParticleSystem(ThreadPool& pool, std::vector<ParticleEmitter> emitters, float floorY, unsigned int particles)
+        : pool(pool), emitters(std::move(emitters)), floorY(floorY)
+    {
+        if (this->emitters.size() > maxEmitters)
+        {
+            std::cout << "WARNING::PARTICLES::TOO_MANY_EMITTERS, only the first " << maxEmitters << " emit"
+                      << std::endl;
+            this->emitters.resize(maxEmitters);
+        }
+
+        glGenBuffers(1, &positionBuffer);
+        glGenBuffers(1, &velocityBuffer);
+        glGenVertexArrays(1, &VAO);
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribDivisor(0, 1);
+        glState.bindVertexArray(0);
+
+        if (gpuSupported())
+        {
+            simulateShader = std::make_unique<Shader>("particles.comp");
+            simulateShader->setFloat("floorY", floorY);
+        }
+        drawShader.setInt("textures[0]", 0);
+        drawShader.setInt("textures[1]", 1);
+        currentPath = gpuSupported() ? ParticlePath::Gpu : ParticlePath::Cpu;
+        resize(particles);
+    }
+
+    ~ParticleSystem()
+    {
+        glState.forgetBuffer(positionBuffer);
+        glState.forgetBuffer(velocityBuffer);
+        glState.forgetVertexArray(VAO);
+        glDeleteBuffers(1, &positionBuffer);
+        glDeleteBuffers(1, &velocityBuffer);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    // Only there when gpuSupported()
+    Shader* simulateProgram() { return simulateShader.get(); }
+    Shader& drawProgram() { return drawShader; }
+
+    ParticlePath path() const { return currentPath; }
+    unsigned int size() const { return count; }
+
+    // Switching paths starts the particles over, the state is not carried between CPU and GPU
+    void setPath(ParticlePath path)
+    {
+        if (path == ParticlePath::Gpu && !gpuSupported())
+            path = ParticlePath::Cpu;
+        if (path != currentPath)
+        {
+            currentPath = path;
+            spawn();
+        }
+    }
+
+    // Rounded up to whole work groups, every particle is spawned again
+    void resize(unsigned int particles)
+    {
+        count = (particles + groupSize - 1) / groupSize * groupSize;
+        for (auto* array : {&px, &py, &pz, &age, &vx, &vy, &vz, &life})
+            array->assign(count, 0.0f);
+
+        // Emitter ranges in whole SIMD groups, the last emitter takes what rounding leaves
+        float totalShare = 0.0f;
+        for (const auto& emitter : emitters)
+            totalShare += emitter.share;
+        ends.clear();
+        unsigned int first = 0;
+        for (size_t e = 0; e < emitters.size(); e++)
+        {
+            unsigned int share = static_cast<unsigned int>(emitters[e].share / totalShare * count) / lanes * lanes;
+            if (e + 1 == emitters.size())
+                share = count - first;
+            ends.push_back(std::min(first + share, count));
+            first = ends.back();
+        }
+
+        // CPU jobs never straddle two emitters, a job reads one emitter's constants for all its lanes
+        jobs.clear();
+        first = 0;
+        for (size_t e = 0; e < ends.size(); e++)
+        {
+            for (unsigned int begin = first; begin < ends[e]; begin += jobSize)
+                jobs.push_back({static_cast<unsigned int>(e), begin, std::min(begin + jobSize, ends[e])});
+            first = ends[e];
+        }
+
+        uploadEmitters();
+        spawn();
+    }
+
+    void update(float deltaTime)
+    {
+        if (!count)
+        {
+            return;
+        }
+        timer.begin();
+        const uint32_t seed = particleHash(frame++);
+        if (currentPath == ParticlePath::Gpu)
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, velocityBuffer);
+            simulateShader->setInt("particleCount", static_cast<int>(count));
+            simulateShader->setFloat("deltaTime", deltaTime);
+            simulateShader->setInt("seed", static_cast<int>(seed));
+            simulateShader->use();
+            glExt.dispatchCompute(count / groupSize, 1, 1);
+            // The draw reads the positions as an instance attribute
+            glExt.memoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        }
+        else
+        {
+            const auto begin = std::chrono::steady_clock::now();
+            glState.bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+            auto* out = static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, count * 4 * sizeof(float),
+                                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            if (out)
+            {
+                pool.parallelFor(static_cast<unsigned int>(jobs.size()),
+                                 [&](unsigned int job) { simulate(jobs[job], deltaTime, seed, out); });
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+            cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        }
+        timer.mark(Simulate);
+    }
+
+    // Blend the particles over whatever target is bound, textures holds one texture per material
+    void draw(const mat4& view, const mat4& proj, const GLuint* textures)
+    {
+        if (!count)
+        {
+            return;
+        }
+        glState.enable(GL_BLEND);
+        glState.blendFunc(GL_ONE, GL_ONE);
+        glState.colorMask(true);
+        glState.depthMask(false);
+        glState.depthFunc(GL_LESS);
+
+        drawShader.setMat4("view", view);
+        drawShader.setMat4("proj", proj);
+        drawShader.use();
+        for (unsigned int material = 0; material < MaterialCount; material++)
+            glState.bindTexture(material, GL_TEXTURE_2D, textures[material]);
+        glState.bindVertexArray(VAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count));
+
+        glState.depthMask(true);
+        glState.disable(GL_BLEND);
+        timer.mark(Draw);
+        timer.end();
+
+        particleStats.particles += count;
+        particleStats.simulateMs += currentPath == ParticlePath::Gpu ? timer.lastMs(Simulate) : cpuMs;
+        particleStats.drawMs += timer.lastMs(Draw);
+        particleStats.frames++;
+    }
+
+private:
+    static constexpr unsigned int groupSize = 256;
+    static constexpr unsigned int lanes = 8;
+    static constexpr unsigned int jobSize = 16384;
+    static constexpr float restitution = 0.35f;
+
+    struct Job
+    {
+        unsigned int emitter;
+        unsigned int first;
+        unsigned int last;
+    };
+
+    static float random(uint32_t& state)
+    {
+        state = particleHash(state);
+        return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Integrate one job's particles and write their positions to out, dead ones are respawned afterwards
+    void simulate(const Job& job, float deltaTime, uint32_t seed, float* out)
+    {
+        const auto& emitter = emitters[job.emitter];
+        const float dragFactor = std::max(1.0f - emitter.drag * deltaTime, 0.0f);
+        const float fall = emitter.gravity * deltaTime;
+#if defined(__AVX__)
+        const __m256 dt = _mm256_set1_ps(deltaTime);
+        const __m256 drag = _mm256_set1_ps(dragFactor);
+        const __m256 ground = _mm256_set1_ps(floorY);
+#endif
+        for (unsigned int i = job.first; i < job.last; i += lanes)
+        {
+#if defined(__AVX__)
+            __m256 x = _mm256_loadu_ps(&px[i]);
+            __m256 y = _mm256_loadu_ps(&py[i]);
+            __m256 z = _mm256_loadu_ps(&pz[i]);
+            __m256 t = _mm256_loadu_ps(&age[i]);
+            __m256 u = _mm256_mul_ps(_mm256_loadu_ps(&vx[i]), drag);
+            __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&vy[i]), _mm256_set1_ps(fall)), drag);
+            __m256 w = _mm256_mul_ps(_mm256_loadu_ps(&vz[i]), drag);
+            x = _mm256_add_ps(x, _mm256_mul_ps(u, dt));
+            y = _mm256_add_ps(y, _mm256_mul_ps(v, dt));
+            z = _mm256_add_ps(z, _mm256_mul_ps(w, dt));
+            const __m256 below = _mm256_cmp_ps(y, ground, _CMP_LT_OQ);
+            y = _mm256_max_ps(y, ground);
+            v = _mm256_blendv_ps(v, _mm256_mul_ps(v, _mm256_set1_ps(-restitution)), below);
+            t = _mm256_add_ps(t, _mm256_div_ps(dt, _mm256_loadu_ps(&life[i])));
+            _mm256_storeu_ps(&px[i], x);
+            _mm256_storeu_ps(&py[i], y);
+            _mm256_storeu_ps(&pz[i], z);
+            _mm256_storeu_ps(&age[i], t);
+            _mm256_storeu_ps(&vx[i], u);
+            _mm256_storeu_ps(&vy[i], v);
+            _mm256_storeu_ps(&vz[i], w);
+
+            // Structure of arrays to one vec4 per particle: 2x2 transposes within each half, then swap halves
+            const __m256 xy0 = _mm256_unpacklo_ps(x, y);
+            const __m256 xy1 = _mm256_unpackhi_ps(x, y);
+            const __m256 zt0 = _mm256_unpacklo_ps(z, t);
+            const __m256 zt1 = _mm256_unpackhi_ps(z, t);
+            const __m256 p0 = _mm256_shuffle_ps(xy0, zt0, 0x44);
+            const __m256 p1 = _mm256_shuffle_ps(xy0, zt0, 0xEE);
+            const __m256 p2 = _mm256_shuffle_ps(xy1, zt1, 0x44);
+            const __m256 p3 = _mm256_shuffle_ps(xy1, zt1, 0xEE);
+            _mm256_storeu_ps(out + i * 4, _mm256_permute2f128_ps(p0, p1, 0x20));
+            _mm256_storeu_ps(out + i * 4 + 8, _mm256_permute2f128_ps(p2, p3, 0x20));
+            _mm256_storeu_ps(out + i * 4 + 16, _mm256_permute2f128_ps(p0, p1, 0x31));
+            _mm256_storeu_ps(out + i * 4 + 24, _mm256_permute2f128_ps(p2, p3, 0x31));
+
+            int dead = _mm256_movemask_ps(_mm256_cmp_ps(t, _mm256_set1_ps(1.0f), _CMP_GE_OQ));
+#else
+            // Same as the AVX path one lane at a time, simple enough for the compiler to vectorize with SSE
+            int dead = 0;
+            for (unsigned int lane = 0; lane < lanes; lane++)
+            {
+                const unsigned int p = i + lane;
+                vx[p] *= dragFactor;
+                vy[p] = (vy[p] - fall) * dragFactor;
+                vz[p] *= dragFactor;
+                px[p] += vx[p] * deltaTime;
+                py[p] += vy[p] * deltaTime;
+                pz[p] += vz[p] * deltaTime;
+                const bool below = py[p] < floorY;
+                py[p] = std::max(py[p], floorY);
+                vy[p] = below ? vy[p] * -restitution : vy[p];
+                age[p] += deltaTime / life[p];
+                out[p * 4] = px[p];
+                out[p * 4 + 1] = py[p];
+                out[p * 4 + 2] = pz[p];
+                out[p * 4 + 3] = age[p];
+                dead |= (age[p] >= 1.0f) << lane;
+            }
+#endif
+            for (unsigned int lane = 0; dead; lane++, dead >>= 1)
+            {
+                if (dead & 1)
+                    respawn(i + lane, emitter, seed, out);
+            }
+        }
+    }
+
+    // Born again somewhere in the emitter's box, the order of the random numbers matches particles.comp
+    void respawn(unsigned int i, const ParticleEmitter& emitter, uint32_t seed, float* out)
+    {
+        uint32_t state = particleHash(i ^ seed);
+        px[i] = emitter.center.x + (random(state) * 2.0f - 1.0f) * emitter.extents.x;
+        py[i] = emitter.center.y + (random(state) * 2.0f - 1.0f) * emitter.extents.y;
+        pz[i] = emitter.center.z + (random(state) * 2.0f - 1.0f) * emitter.extents.z;
+        vx[i] = emitter.velocity.x + (random(state) * 2.0f - 1.0f) * emitter.spread.x;
+        vy[i] = emitter.velocity.y + (random(state) * 2.0f - 1.0f) * emitter.spread.y;
+        vz[i] = emitter.velocity.z + (random(state) * 2.0f - 1.0f) * emitter.spread.z;
+        life[i] = emitter.minLife + random(state) * (emitter.maxLife - emitter.minLife);
+        age[i] = 0.0f;
+        if (out)
+        {
+            out[i * 4] = px[i];
+            out[i * 4 + 1] = py[i];
+            out[i * 4 + 2] = pz[i];
+            out[i * 4 + 3] = age[i];
+        }
+    }
+
+    // Start every particle at a random point of its life so they do not all die in the same frame, and give both
+    // paths the same starting state
+    void spawn()
+    {
+        size_t first = 0;
+        for (size_t e = 0; e < ends.size(); e++)
+        {
+            for (size_t i = first; i < ends[e]; i++)
+            {
+                respawn(static_cast<unsigned int>(i), emitters[e], 0x5EED5EEDu, nullptr);
+                uint32_t state = particleHash(static_cast<uint32_t>(i));
+                age[i] = random(state);
+            }
+            first = ends[e];
+        }
+
+        std::vector<float> positions(count * 4);
+        std::vector<float> velocities(count * 4);
+        for (size_t i = 0; i < count; i++)
+        {
+            const float position[4] = {px[i], py[i], pz[i], age[i]};
+            const float velocity[4] = {vx[i], vy[i], vz[i], life[i]};
+            std::copy(position, position + 4, &positions[i * 4]);
+            std::copy(velocity, velocity + 4, &velocities[i * 4]);
+        }
+        glState.bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_DYNAMIC_DRAW);
+        glState.bindBuffer(GL_ARRAY_BUFFER, velocityBuffer);
+        glBufferData(GL_ARRAY_BUFFER, velocities.size() * sizeof(float), velocities.data(), GL_DYNAMIC_COPY);
+    }
+
+    // Emitters never change, their constants go to the programs once per resize
+    void uploadEmitters()
+    {
+        for (size_t e = 0; e < emitters.size(); e++)
+        {
+            const auto& emitter = emitters[e];
+            const std::string index = "[" + std::to_string(e) + "]";
+            drawShader.setInt("emitterEnd" + index, static_cast<int>(ends[e]));
+            drawShader.setVec4("emitterLook" + index, emitter.color.x, emitter.color.y, emitter.color.z, emitter.size);
+            drawShader.setInt("emitterMaterial" + index, emitter.material);
+            if (simulateShader)
+            {
+                simulateShader->setInt("emitterEnd" + index, static_cast<int>(ends[e]));
+                simulateShader->setVec3("emitterCenter" + index, emitter.center);
+                simulateShader->setVec3("emitterExtents" + index, emitter.extents);
+                simulateShader->setVec3("emitterVelocity" + index, emitter.velocity);
+                simulateShader->setVec3("emitterSpread" + index, emitter.spread);
+                simulateShader->setVec4("emitterMotion" + index, emitter.gravity, emitter.drag, emitter.minLife,
+                                        emitter.maxLife);
+            }
+        }
+        drawShader.setInt("emitterCount", static_cast<int>(emitters.size()));
+        if (simulateShader)
+            simulateShader->setInt("emitterCount", static_cast<int>(emitters.size()));
+    }
+
+    ThreadPool& pool;
+    std::vector<ParticleEmitter> emitters;
+    float floorY;
+    std::vector<unsigned int> ends;
+    std::vector<Job> jobs;
+    unsigned int count = 0;
+    uint32_t frame = 0;
+    ParticlePath currentPath = ParticlePath::Cpu;
+    double cpuMs = 0.0;
+
+    // Structure of arrays, the CPU path's state
+    std::vector<float> px, py, pz, age;
+    std::vector<float> vx, vy, vz, life;
+
+    std::unique_ptr<Shader> simulateShader;
+    Shader drawShader{"particle.vert", "particle.frag"};
+    GpuPassTimer timer{PassCount};
+    GLuint positionBuffer = 0;
+    GLuint velocityBuffer = 0;
+    GLuint VAO = 0;
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "culling.h"
+#include "math.h"
+#include "scene.h"
+
+// Convex set of inward facing planes, the camera frustum narrowed by every portal it was seen through.
+struct ClipVolume
+{
+    static const int maxPlanes = 16;
+    vec4 planes[maxPlanes];
+    int count = 0;
+};
+
+// Doorway between two cells, a convex quad.
+struct Portal
+{
+    vec3 corners[4];
+    unsigned int cells[2];
+};
+
+// Convex room or corridor segment with the renderables overlapping it.
+struct Cell
+{
+    Bounds bounds;
+    std::vector<unsigned int> renderables;
+    std::vector<unsigned int> portals;
+};
+
+struct PortalStats
+{
+    unsigned long cellsVisited = 0;
+    unsigned long portalsTested = 0;
+};
+
+inline PortalStats portalStats;
+
+// Cell-and-portal visibility. Starting in the camera's cell, the walk only crosses portals that are visible in the
+// current clip volume and narrows the volume to each portal's outline, so only cells actually seen through
+// doorways are reached. Each cell is entered at most once per walk, the cost is O(visible cells).
+class CellGraph
+{
+public:
+    std::vector<Cell> cells;
+    std::vector<Portal> portals;
+
+    // Size the per-walk bookkeeping once cells and their renderables are filled in
+    void finalize(size_t renderableCount)
+    {
+        renderableStamp.assign(renderableCount, 0);
+        cellStamp.assign(cells.size(), 0);
+    }
+
+    // Index of the cell containing the point, -1 when outside every cell. The camera rarely moves further than a
+    // neighbouring cell per frame, so the last result and its neighbours are tried before scanning everything.
+    int findCell(const vec3& point)
+    {
+        if (lastCell >= 0 && lastCell < static_cast<int>(cells.size()))
+        {
+            if (contains(cells[lastCell].bounds, point))
+                return lastCell;
+            for (auto p : cells[lastCell].portals)
+            {
+                for (auto c : portals[p].cells)
+                {
+                    if (contains(cells[c].bounds, point))
+                        return lastCell = c;
+                }
+            }
+        }
+        for (unsigned int i = 0; i < cells.size(); i++)
+        {
+            if (contains(cells[i].bounds, point))
+                return lastCell = i;
+        }
+        return -1;
+    }
+
+    // Write the visible renderables to visible. Returns false when the eye is outside every cell, the caller should
+    // fall back to plain frustum culling then.
+    bool walk(const vec3& eye, const Frustum& frustum, const std::vector<Bounds>& bounds,
+              std::vector<unsigned int>& visible)
+    {
+        visible.clear();
+        const int start = findCell(eye);
+        if (start < 0)
+        {
+            return false;
+        }
+
+        // Stamps instead of clearing visited flags keep the walk proportional to what it reaches
+        stamp++;
+        const auto begin = std::chrono::steady_clock::now();
+
+        // Near and far always lead the volume, portals only replace the side planes
+        ClipVolume volume;
+        volume.planes[volume.count++] = frustum.planes[4];
+        volume.planes[volume.count++] = frustum.planes[5];
+        for (int i = 0; i < 4; i++)
+            volume.planes[volume.count++] = frustum.planes[i];
+
+        stack.clear();
+        stack.push_back({static_cast<unsigned int>(start), volume});
+        cellStamp[start] = stamp;
+
+        while (!stack.empty())
+        {
+            const auto [cellIndex, clip] = stack.back();
+            stack.pop_back();
+            const auto& cell = cells[cellIndex];
+            portalStats.cellsVisited++;
+
+            for (auto i : cell.renderables)
+            {
+                if (renderableStamp[i] == stamp)
+                {
+                    continue;
+                }
+                cullingStats.tested++;
+                if (isVisible(clip.planes, clip.count, bounds[i]))
+                {
+                    renderableStamp[i] = stamp;
+                    visible.push_back(i);
+                }
+            }
+
+            for (auto p : cell.portals)
+            {
+                const auto& portal = portals[p];
+                const unsigned int next = portal.cells[0] == cellIndex ? portal.cells[1] : portal.cells[0];
+                if (cellStamp[next] == stamp)
+                {
+                    continue;
+                }
+                portalStats.portalsTested++;
+
+                ClipVolume narrowed;
+                if (!narrow(eye, clip, portal, narrowed))
+                {
+                    continue;
+                }
+                cellStamp[next] = stamp;
+                stack.push_back({next, narrowed});
+            }
+        }
+
+        cullingStats.visible += visible.size();
+        cullingStats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        return true;
+    }
+
+private:
+    struct Pending
+    {
+        unsigned int cell;
+        ClipVolume volume;
+    };
+
+    static bool contains(const Bounds& b, const vec3& p)
+    {
+        return std::fabs(p.x - b.center.x) <= b.extents.x && std::fabs(p.y - b.center.y) <= b.extents.y &&
+               std::fabs(p.z - b.center.z) <= b.extents.z;
+    }
+
+    static float distance(const vec4& plane, const vec3& p)
+    {
+        return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+    }
+
+    // Clip the portal against the volume and build planes through the eye and each edge of what is left. Returns
+    // false if nothing of the portal is visible.
+    static bool narrow(const vec3& eye, const ClipVolume& volume, const Portal& portal, ClipVolume& out)
+    {
+        // Standing in the doorway leaves no usable outline, keep looking through the current volume
+        const vec3 portalNormal =
+            (portal.corners[1] - portal.corners[0]).cross(portal.corners[2] - portal.corners[0]).normalize();
+        if (std::fabs(portalNormal.dot(eye - portal.corners[0])) < 1e-3f)
+        {
+            out = volume;
+            return true;
+        }
+
+        // Sutherland-Hodgman against every plane, each plane adds at most one vertex
+        vec3 polygon[4 + ClipVolume::maxPlanes];
+        vec3 clipped[4 + ClipVolume::maxPlanes];
+        int count = 4;
+        for (int i = 0; i < 4; i++)
+            polygon[i] = portal.corners[i];
+
+        for (int p = 0; p < volume.count && count > 0; p++)
+        {
+            const auto& plane = volume.planes[p];
+            int clippedCount = 0;
+            for (int i = 0; i < count; i++)
+            {
+                const auto& a = polygon[i];
+                const auto& b = polygon[(i + 1) % count];
+                const float da = distance(plane, a);
+                const float db = distance(plane, b);
+                if (da >= 0.0f)
+                    clipped[clippedCount++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                    clipped[clippedCount++] = a + (b - a) * (da / (da - db));
+            }
+            count = std::min(clippedCount, 4 + ClipVolume::maxPlanes - 1);
+            for (int i = 0; i < count; i++)
+                polygon[i] = clipped[i];
+        }
+        if (count < 3)
+        {
+            return false;
+        }
+
+        vec3 centroid{0.0f};
+        for (int i = 0; i < count; i++)
+            centroid += polygon[i];
+        centroid = centroid / static_cast<float>(count);
+
+        // Near and far carry over, then one plane through the eye and each edge of the clipped outline
+        out.count = 0;
+        out.planes[out.count++] = volume.planes[0];
+        out.planes[out.count++] = volume.planes[1];
+        for (int i = 0; i < count && out.count < ClipVolume::maxPlanes; i++)
+        {
+            const auto& a = polygon[i];
+            const auto& b = polygon[(i + 1) % count];
+            auto normal = (a - eye).cross(b - eye);
+            if (normal.magnitude() < 1e-6f)
+                continue;
+            normal = normal.normalize();
+            vec4 plane{normal.x, normal.y, normal.z, -normal.dot(eye)};
+            if (distance(plane, centroid) < 0.0f)
+                plane = vec4{-plane.x, -plane.y, -plane.z, -plane.w};
+            out.planes[out.count++] = plane;
+        }
+        return true;
+    }
+
+    std::vector<Pending> stack;
+    std::vector<unsigned int> renderableStamp;
+    std::vector<unsigned int> cellStamp;
+    unsigned int stamp = 0;
+    int lastCell = -1;
+};
+
+// One cell per corridor segment joined by full cross-section portals. Matches the layout of buildCorridor().
+inline CellGraph buildCorridorCells(int segments, const std::vector<Bounds>& bounds)
+{
+    CellGraph graph;
+
+    // Corridor cross-section, slightly padded so surfaces on the boundary land in the cell
+    const float minX = -0.3f, maxX = 10.0f;
+    const float minY = -1.0f, maxY = 3.5f;
+    const float pad = 0.05f;
+
+    for (int i = 0; i < segments; i++)
+    {
+        const float nearZ = -i * corridorSegmentLength + corridorSegmentLength / 2;
+        const float farZ = nearZ - corridorSegmentLength;
+
+        Cell cell;
+        cell.bounds.center = vec3{(minX + maxX) / 2, (minY + maxY) / 2, (nearZ + farZ) / 2};
+        cell.bounds.extents = vec3{(maxX - minX) / 2 + pad, (maxY - minY) / 2 + pad, corridorSegmentLength / 2 + pad};
+        graph.cells.push_back(cell);
+
+        if (i > 0)
+        {
+            Portal portal;
+            portal.corners[0] = vec3{minX, minY, nearZ};
+            portal.corners[1] = vec3{maxX, minY, nearZ};
+            portal.corners[2] = vec3{maxX, maxY, nearZ};
+            portal.corners[3] = vec3{minX, maxY, nearZ};
+            portal.cells[0] = i - 1;
+            portal.cells[1] = i;
+            graph.cells[i - 1].portals.push_back(graph.portals.size());
+            graph.cells[i].portals.push_back(graph.portals.size());
+            graph.portals.push_back(portal);
+        }
+    }
+
+    // Cells are evenly spaced along -z, so each renderable maps straight to the range of cells it overlaps
+    for (unsigned int r = 0; r < bounds.size(); r++)
+    {
+        const float zMax = bounds[r].center.z + bounds[r].extents.z;
+        const float zMin = bounds[r].center.z - bounds[r].extents.z;
+        const float start = corridorSegmentLength / 2 + pad;
+        int first = static_cast<int>(std::floor((start - zMax) / corridorSegmentLength));
+        int last = static_cast<int>(std::floor((start + 2 * pad - zMin) / corridorSegmentLength));
+        first = std::max(first, 0);
+        last = std::min(last, segments - 1);
+        for (int c = first; c <= last; c++)
+            graph.cells[c].renderables.push_back(r);
+    }
+
+    graph.finalize(bounds.size());
+    return graph;
+}
@@ -1,12 +1,16 @@
 #version 330 core
 
 in vec2 TexCoord;
+in vec3 ViewPos;
 
 out vec4 FragColor;
 
 uniform sampler2D texture1;
 
+#include "lighting.glsl"
+
 void main()
 {
-    FragColor = texture(texture1, TexCoord);
+    vec4 albedo = texture(texture1, TexCoord);
+    FragColor = lighting ? vec4(shade(albedo.rgb), albedo.a) : albedo;
 }
@@ -4,13 +4,18 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
+out vec3 ViewPos;
 
 uniform mat4 proj;
 uniform mat4 view;
 uniform mat4 model;
 
+// The depth pre-pass computes the same position, GL_EQUAL needs the results bit for bit identical
+invariant gl_Position;
+
 void main()
 {
     gl_Position = proj * view * model * vec4(aPos, 1.0);
     TexCoord = aTexCoord;
+    ViewPos = vec3(view * model * vec4(aPos, 1.0));
 }
@@ -0,0 +1,20 @@
+#version 330 core
+
+in vec2 TexCoord;
+in vec3 ViewPos;
+flat in uint Material;
+
+out vec4 FragColor;
+
+uniform sampler2D textures[2];
+
+#include "lighting.glsl"
+
+void main()
+{
+    // One multi-draw covers every material, sample both so the lookups stay in uniform control flow
+    vec4 wallColor = texture(textures[0], TexCoord);
+    vec4 floorColor = texture(textures[1], TexCoord);
+    vec4 albedo = Material == 0u ? wallColor : floorColor;
+    FragColor = lighting ? vec4(shade(albedo.rgb), albedo.a) : albedo;
+}
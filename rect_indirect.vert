@@ -0,0 +1,31 @@
+#version 430 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+// Object index, per instance. Each indirect command's baseInstance offsets it into that command's range.
+layout (location = 2) in uint aObject;
+
+struct Object
+{
+    mat4 model;
+    vec4 center;  // w holds the material
+    vec4 extents;
+};
+
+layout (std430, binding = 0) readonly buffer Objects { Object objects[]; };
+
+out vec2 TexCoord;
+out vec3 ViewPos;
+flat out uint Material;
+
+uniform mat4 proj;
+uniform mat4 view;
+
+void main()
+{
+    Object object = objects[aObject];
+    gl_Position = proj * view * object.model * vec4(aPos, 1.0);
+    TexCoord = aTexCoord;
+    ViewPos = vec3(view * object.model * vec4(aPos, 1.0));
+    Material = uint(object.center.w);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in mat4 aModel;
+layout (location = 6) in uint aMaterial;
+
+out vec2 TexCoord;
+out vec3 ViewPos;
+flat out uint Material;
+
+uniform mat4 proj;
+uniform mat4 view;
+
+// The depth pre-pass computes the same position, GL_EQUAL needs the results bit for bit identical
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = proj * view * aModel * vec4(aPos, 1.0);
+    TexCoord = aTexCoord;
+    ViewPos = vec3(view * aModel * vec4(aPos, 1.0));
+    Material = aMaterial;
+}
@@ -0,0 +1,633 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gl_state.h"
+#include "math.h"
+
+struct RenderGraphStats
+{
+    unsigned long passes = 0;
+    unsigned long culled = 0;
+    unsigned long transients = 0;
+    unsigned long allocations = 0;
+    double requestedBytes = 0.0;
+    double allocatedBytes = 0.0;
+    unsigned long reallocations = 0;
+};
+
+inline RenderGraphStats renderGraphStats;
+
+// Per-frame graph of the fullscreen passes that follow the scene. Every frame the passes are declared again with
+// the textures they read and write, then compile() works out what actually has to run:
+//
+// - Culling walks back from the passes that write an output, the default framebuffer or anything imported as one.
+//   A pass nothing live reads from is dropped together with its inputs, so a feature can declare its passes
+//   unconditionally and let its consumers decide whether it runs.
+// - Ordering is a topological sort over the resources. Writers of a resource run in the order they were declared
+//   and a pass that only reads it runs after all of them, it sees the finished contents.
+// - Transient textures live from their first to their last use in that order. Transients of the same format whose
+//   lifetimes do not overlap share one texture, sized for the largest of them, the smaller ones render into its
+//   lower left corner. GL 3.3 has no way to place textures of different formats in the same memory, so sharing a
+//   texture object is as far as aliasing goes.
+//
+// Transients are only valid inside the frame and undefined until their first writer runs. Their textures and the
+// framebuffers built over them persist across frames, the same graph every frame allocates nothing. Anything that
+// has to survive the frame, like a history, is owned outside the graph and imported.
+class RenderGraph
+{
+public:
+    using Resource = int;
+    static constexpr Resource none = -1;
+
+    struct TextureDesc
+    {
+        int width = 1;
+        int height = 1;
+        GLenum format = GL_RGBA8;
+    };
+
+    // What a pass sees of the graph while it executes
+    class Context
+    {
+    public:
+        GLuint texture(Resource resource) const { return graph.resources[resource].texture; }
+
+        // Fraction of its texture the resource covers, for passes that sample with normalised coordinates
+        vec2 uvScale(Resource resource) const
+        {
+            const auto& node = graph.resources[resource];
+            return vec2{static_cast<float>(node.desc.width) / node.textureWidth,
+                        static_cast<float>(node.desc.height) / node.textureHeight};
+        }
+
+        void bindTexture(GLuint unit, Resource resource) const
+        {
+            glState.bindTexture(unit, GL_TEXTURE_2D, texture(resource));
+        }
+
+        // Render into color and optionally depth, with the viewport covering the resource
+        void bindTarget(Resource color, Resource depth = none) const { graph.bindTarget(color, depth); }
+
+    private:
+        friend class RenderGraph;
+        explicit Context(RenderGraph& graph) : graph(graph) {}
+        RenderGraph& graph;
+    };
+
+    RenderGraph() = default;
+
+    ~RenderGraph()
+    {
+        for (auto& entry : framebuffers)
+        {
+            glState.forgetFramebuffer(entry.second);
+            glDeleteFramebuffers(1, &entry.second);
+        }
+        for (auto& physical : pool)
+        {
+            glState.forgetTexture(physical.texture);
+            glDeleteTextures(1, &physical.texture);
+        }
+    }
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Drop the previous frame's passes and resources, the textures behind them stay for reuse
+    void reset()
+    {
+        passes.clear();
+        resources.clear();
+        order.clear();
+        frame++;
+    }
+
+    // A texture that only lives inside this frame
+    Resource createTexture(const char* name, const TextureDesc& desc)
+    {
+        ResourceNode node;
+        node.name = name;
+        node.desc = desc;
+        resources.push_back(node);
+        return static_cast<Resource>(resources.size() - 1);
+    }
+
+    // A texture owned outside the graph. desc is the region passes use, textureWidth x textureHeight the whole
+    // allocation. Passes writing an output are never culled.
+    Resource importTexture(const char* name, GLuint texture, const TextureDesc& desc, int textureWidth,
+                           int textureHeight, bool output = false)
+    {
+        ResourceNode node;
+        node.name = name;
+        node.desc = desc;
+        node.texture = texture;
+        node.textureWidth = textureWidth;
+        node.textureHeight = textureHeight;
+        node.imported = true;
+        node.output = output;
+        resources.push_back(node);
+        return static_cast<Resource>(resources.size() - 1);
+    }
+
+    // The default framebuffer, what ends up on screen
+    Resource importBackbuffer(int width, int height)
+    {
+        const auto resource = importTexture("backbuffer", 0, TextureDesc{width, height, GL_RGBA8}, width, height, true);
+        resources[resource].backbuffer = true;
+        return resource;
+    }
+
+    void addPass(const char* name, std::vector<Resource> reads, std::vector<Resource> writes,
+                 std::function<void(Context&)> execute)
+    {
+        PassNode pass;
+        pass.name = name;
+        pass.reads = std::move(reads);
+        pass.writes = std::move(writes);
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+    }
+
+    // Cull, order and place the transients
+    void compile()
+    {
+        cull();
+        sortPasses();
+        assignTextures();
+
+        renderGraphStats.passes += order.size();
+        renderGraphStats.culled += passes.size() - order.size();
+    }
+
+    void execute()
+    {
+        Context context{*this};
+        for (const int pass : order)
+        {
+            passes[pass].execute(context);
+        }
+    }
+
+    // Print the compiled graph: execution order, culled passes, every resource with its lifetime and texture, and
+    // what aliasing saved
+    void dump(std::ostream& out) const
+    {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << std::fixed << std::setprecision(2);
+        out << "render graph: " << passes.size() << " passes, " << order.size() << " live, "
+            << passes.size() - order.size() << " culled" << std::endl;
+
+        std::vector<int> position(passes.size(), -1);
+        for (size_t i = 0; i < order.size(); i++)
+            position[order[i]] = static_cast<int>(i);
+        const auto names = [this](const std::vector<Resource>& list)
+        {
+            std::string text;
+            for (const auto resource : list)
+                text += (text.empty() ? "" : ", ") + std::string{resources[resource].name};
+            return text.empty() ? std::string{"-"} : text;
+        };
+        for (const int pass : order)
+        {
+            out << "  " << std::setw(2) << position[pass] << " " << std::left << std::setw(18) << passes[pass].name
+                << std::right << " reads " << names(passes[pass].reads) << " | writes " << names(passes[pass].writes)
+                << std::endl;
+        }
+        for (size_t pass = 0; pass < passes.size(); pass++)
+        {
+            if (position[pass] < 0)
+                out << "   - " << std::left << std::setw(18) << passes[pass].name << std::right << " culled"
+                    << std::endl;
+        }
+
+        out << "resources:" << std::endl;
+        double requested = 0.0;
+        int transients = 0;
+        for (const auto& node : resources)
+        {
+            out << "  " << std::left << std::setw(20) << node.name << " " << std::setw(8)
+                << formatInfo(node.desc.format).name << std::right << " " << node.desc.width << "x" << node.desc.height;
+            if (node.imported)
+                out << " imported" << (node.output ? " output" : "");
+            else if (node.firstUse < 0)
+                out << " unused";
+            else
+            {
+                out << " passes " << node.firstUse << "-" << node.lastUse << " in texture " << node.physical;
+                requested += bytes(node.desc.format, node.desc.width, node.desc.height);
+                transients++;
+            }
+            out << std::endl;
+        }
+
+        double allocated = 0.0;
+        int allocations = 0;
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            if (pool[i].lastFrame != frame)
+                continue;
+            out << "  texture " << i << ": " << formatInfo(pool[i].format).name << " " << pool[i].width << "x"
+                << pool[i].height << ", " << bytes(pool[i].format, pool[i].width, pool[i].height) / megabyte << " MB"
+                << std::endl;
+            allocated += bytes(pool[i].format, pool[i].width, pool[i].height);
+            allocations++;
+        }
+        out << "transient memory: " << transients << " textures in " << allocations << " allocations, "
+            << requested / megabyte << " MB requested, " << allocated / megabyte << " MB allocated, "
+            << (requested > 0.0 ? std::max(0.0, 1.0 - allocated / requested) * 100.0 : 0.0) << "% saved"
+            << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    struct FormatInfo
+    {
+        GLenum internalFormat;
+        GLenum format;
+        GLenum type;
+        int bytes;
+        const char* name;
+    };
+
+    struct ResourceNode
+    {
+        const char* name = "";
+        TextureDesc desc;
+        GLuint texture = 0;
+        int textureWidth = 1;
+        int textureHeight = 1;
+        bool imported = false;
+        bool output = false;
+        bool backbuffer = false;
+        // Execution positions of the first and last pass using it, and the pool texture behind a transient
+        int firstUse = -1;
+        int lastUse = -1;
+        int physical = -1;
+    };
+
+    struct PassNode
+    {
+        const char* name = "";
+        std::vector<Resource> reads;
+        std::vector<Resource> writes;
+        std::function<void(Context&)> execute;
+        bool live = false;
+    };
+
+    struct PhysicalTexture
+    {
+        GLuint texture = 0;
+        GLenum format = GL_RGBA8;
+        int width = 0;
+        int height = 0;
+        // Last execution position of the transient holding it this frame
+        int busyUntil = -1;
+        unsigned int lastFrame = 0;
+    };
+
+    static constexpr double megabyte = 1024.0 * 1024.0;
+    // Pool textures no graph has used for this many frames are released
+    static constexpr unsigned int evictionFrames = 120;
+
+    static FormatInfo formatInfo(GLenum internalFormat)
+    {
+        static const FormatInfo formats[] = {
+            {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, "R8"},
+            {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, "RGBA8"},
+            {GL_R32F, GL_RED, GL_FLOAT, 4, "R32F"},
+            {GL_RG16F, GL_RG, GL_FLOAT, 4, "RG16F"},
+            {GL_RGBA16F, GL_RGBA, GL_FLOAT, 8, "RGBA16F"},
+            {GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4, "D24"},
+            {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4, "D24S8"},
+        };
+        for (const auto& info : formats)
+        {
+            if (info.internalFormat == internalFormat)
+                return info;
+        }
+        std::cout << "ERROR::RENDER_GRAPH::UNKNOWN_FORMAT " << internalFormat << std::endl;
+        return formats[1];
+    }
+
+    static double bytes(GLenum format, int width, int height)
+    {
+        return static_cast<double>(width) * height * formatInfo(format).bytes;
+    }
+
+    bool writes(int pass, Resource resource) const
+    {
+        const auto& list = passes[pass].writes;
+        return std::find(list.begin(), list.end(), resource) != list.end();
+    }
+
+    // Passes writing an output are live, and so is every writer of something a live pass reads. A pass that also
+    // writes what it reads only depends on the writers declared before it.
+    void cull()
+    {
+        std::vector<std::vector<int>> writers(resources.size());
+        std::vector<int> work;
+        for (size_t pass = 0; pass < passes.size(); pass++)
+        {
+            passes[pass].live = false;
+            for (const auto resource : passes[pass].writes)
+            {
+                writers[resource].push_back(static_cast<int>(pass));
+                if (resources[resource].output && !passes[pass].live)
+                {
+                    passes[pass].live = true;
+                    work.push_back(static_cast<int>(pass));
+                }
+            }
+        }
+
+        while (!work.empty())
+        {
+            const int pass = work.back();
+            work.pop_back();
+            for (const auto resource : passes[pass].reads)
+            {
+                const bool readModifyWrite = writes(pass, resource);
+                for (const int writer : writers[resource])
+                {
+                    if (readModifyWrite && writer >= pass)
+                        break;
+                    if (!passes[writer].live)
+                    {
+                        passes[writer].live = true;
+                        work.push_back(writer);
+                    }
+                }
+            }
+        }
+    }
+
+    // Kahn's algorithm over the live passes, ties go to the pass declared first
+    void sortPasses()
+    {
+        std::vector<std::vector<int>> edges(passes.size());
+        std::vector<int> incoming(passes.size(), 0);
+        const auto link = [&](int from, int to)
+        {
+            edges[from].push_back(to);
+            incoming[to]++;
+        };
+        for (size_t resource = 0; resource < resources.size(); resource++)
+        {
+            int lastWriter = -1;
+            for (size_t pass = 0; pass < passes.size(); pass++)
+            {
+                if (!passes[pass].live || !writes(static_cast<int>(pass), static_cast<Resource>(resource)))
+                    continue;
+                if (lastWriter >= 0)
+                    link(lastWriter, static_cast<int>(pass));
+                lastWriter = static_cast<int>(pass);
+            }
+            for (size_t pass = 0; pass < passes.size(); pass++)
+            {
+                const auto& reads = passes[pass].reads;
+                if (!passes[pass].live || writes(static_cast<int>(pass), static_cast<Resource>(resource)) ||
+                    std::find(reads.begin(), reads.end(), static_cast<Resource>(resource)) == reads.end())
+                    continue;
+                if (lastWriter >= 0)
+                    link(lastWriter, static_cast<int>(pass));
+                else if (!resources[resource].imported)
+                    std::cout << "ERROR::RENDER_GRAPH::READ_BEFORE_WRITE " << resources[resource].name << " in "
+                              << passes[pass].name << std::endl;
+            }
+        }
+
+        std::priority_queue<int, std::vector<int>, std::greater<int>> ready;
+        size_t live = 0;
+        for (size_t pass = 0; pass < passes.size(); pass++)
+        {
+            if (!passes[pass].live)
+                continue;
+            live++;
+            if (incoming[pass] == 0)
+                ready.push(static_cast<int>(pass));
+        }
+        while (!ready.empty())
+        {
+            const int pass = ready.top();
+            ready.pop();
+            order.push_back(pass);
+            for (const int next : edges[pass])
+            {
+                if (--incoming[next] == 0)
+                    ready.push(next);
+            }
+        }
+        if (order.size() != live)
+        {
+            std::cout << "ERROR::RENDER_GRAPH::CYCLE" << std::endl;
+            order.clear();
+            for (size_t pass = 0; pass < passes.size(); pass++)
+            {
+                if (passes[pass].live)
+                    order.push_back(static_cast<int>(pass));
+            }
+        }
+    }
+
+    // Greedy interval assignment in order of first use. A free pool texture of the same format that already fits
+    // is preferred, then the largest free one, grown to fit, then a new one.
+    void assignTextures()
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const auto use = [&](const std::vector<Resource>& list)
+            {
+                for (const auto resource : list)
+                {
+                    auto& node = resources[resource];
+                    if (node.firstUse < 0)
+                        node.firstUse = static_cast<int>(i);
+                    node.lastUse = static_cast<int>(i);
+                }
+            };
+            use(passes[order[i]].reads);
+            use(passes[order[i]].writes);
+        }
+
+        evict();
+        for (auto& physical : pool)
+            physical.busyUntil = -1;
+
+        std::vector<Resource> transients;
+        for (size_t resource = 0; resource < resources.size(); resource++)
+        {
+            if (!resources[resource].imported && resources[resource].firstUse >= 0)
+                transients.push_back(static_cast<Resource>(resource));
+        }
+        std::stable_sort(transients.begin(), transients.end(),
+                         [this](Resource a, Resource b) { return resources[a].firstUse < resources[b].firstUse; });
+
+        for (const auto resource : transients)
+        {
+            auto& node = resources[resource];
+            int best = -1;
+            bool bestFits = false;
+            for (size_t i = 0; i < pool.size(); i++)
+            {
+                const auto& physical = pool[i];
+                if (physical.format != node.desc.format || physical.busyUntil >= node.firstUse)
+                    continue;
+                const bool fits = physical.width >= node.desc.width && physical.height >= node.desc.height;
+                const double area = static_cast<double>(physical.width) * physical.height;
+                if (best < 0 || (fits && !bestFits) ||
+                    (fits == bestFits &&
+                     (fits ? area < static_cast<double>(pool[best].width) * pool[best].height
+                           : area > static_cast<double>(pool[best].width) * pool[best].height)))
+                {
+                    best = static_cast<int>(i);
+                    bestFits = fits;
+                }
+            }
+            if (best < 0)
+            {
+                PhysicalTexture physical;
+                physical.format = node.desc.format;
+                glGenTextures(1, &physical.texture);
+                pool.push_back(physical);
+                best = static_cast<int>(pool.size() - 1);
+            }
+
+            auto& physical = pool[best];
+            if (physical.width < node.desc.width || physical.height < node.desc.height)
+                grow(physical, node.desc.width, node.desc.height);
+            physical.busyUntil = node.lastUse;
+            physical.lastFrame = frame;
+            node.physical = best;
+            node.texture = physical.texture;
+            renderGraphStats.transients++;
+            renderGraphStats.requestedBytes += bytes(node.desc.format, node.desc.width, node.desc.height);
+        }
+
+        // Corner sizes can only be filled in once every tenant of a texture is placed
+        for (const auto resource : transients)
+        {
+            auto& node = resources[resource];
+            node.textureWidth = pool[node.physical].width;
+            node.textureHeight = pool[node.physical].height;
+        }
+        for (const auto& physical : pool)
+        {
+            if (physical.lastFrame == frame)
+            {
+                renderGraphStats.allocations++;
+                renderGraphStats.allocatedBytes += bytes(physical.format, physical.width, physical.height);
+            }
+        }
+    }
+
+    void grow(PhysicalTexture& physical, int width, int height)
+    {
+        physical.width = std::max(physical.width, width);
+        physical.height = std::max(physical.height, height);
+        renderGraphStats.reallocations++;
+
+        const auto info = formatInfo(physical.format);
+        glState.bindTexture(0, GL_TEXTURE_2D, physical.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, info.internalFormat, physical.width, physical.height, 0, info.format, info.type,
+                     nullptr);
+        // Passes read transients texel by texel, or within their corner at most, filtering is theirs to do
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // Release pool textures that have gone unused, along with the framebuffers built over them
+    void evict()
+    {
+        for (size_t i = 0; i < pool.size();)
+        {
+            if (frame - pool[i].lastFrame <= evictionFrames)
+            {
+                i++;
+                continue;
+            }
+            const GLuint texture = pool[i].texture;
+            for (auto entry = framebuffers.begin(); entry != framebuffers.end();)
+            {
+                if (entry->first.first != texture && entry->first.second != texture)
+                {
+                    ++entry;
+                    continue;
+                }
+                glState.forgetFramebuffer(entry->second);
+                glDeleteFramebuffers(1, &entry->second);
+                entry = framebuffers.erase(entry);
+            }
+            glState.forgetTexture(texture);
+            glDeleteTextures(1, &texture);
+            pool.erase(pool.begin() + static_cast<long>(i));
+        }
+    }
+
+    void bindTarget(Resource color, Resource depth)
+    {
+        const auto& sized = resources[color != none ? color : depth];
+        glState.viewport(0, 0, sized.desc.width, sized.desc.height);
+        if (color != none && resources[color].backbuffer)
+        {
+            glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+            return;
+        }
+
+        const GLuint colorTexture = color != none ? resources[color].texture : 0;
+        const GLuint depthTexture = depth != none ? resources[depth].texture : 0;
+        const auto key = std::make_pair(colorTexture, depthTexture);
+        auto entry = framebuffers.find(key);
+        if (entry != framebuffers.end())
+        {
+            glState.bindFramebuffer(GL_FRAMEBUFFER, entry->second);
+            return;
+        }
+
+        GLuint framebuffer = 0;
+        glGenFramebuffers(1, &framebuffer);
+        glState.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        if (colorTexture)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        }
+        else
+        {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        if (depthTexture)
+        {
+            const GLenum attachment = resources[depth].desc.format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT
+                                                                                           : GL_DEPTH_ATTACHMENT;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depthTexture, 0);
+        }
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        framebuffers.emplace(key, framebuffer);
+    }
+
+    std::vector<PassNode> passes;
+    std::vector<ResourceNode> resources;
+    std::vector<int> order;
+    std::vector<PhysicalTexture> pool;
+    // Keyed by the colour and depth textures attached, 0 for none
+    std::map<std::pair<GLuint, GLuint>, GLuint> framebuffers;
+    unsigned int frame = 0;
+};
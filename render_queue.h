@@ -0,0 +1,381 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "command_buffer.h"
+#include "gl_state.h"
+#include "math.h"
+#include "shader.h"
+#include "thread_pool.h"
+
+// Passes run in enum order, the pass occupies the top bits of the sort key.
+enum class RenderPass : uint64_t
+{
+    DepthPrepass = 0,  // position only, fills the depth buffer
+    Opaque = 1,
+    Count
+};
+
+// Fixed-function state a pass runs with, applied by the queue when submission enters the pass.
+struct PassState
+{
+    bool colorWrite = true;
+    bool depthWrite = true;
+    GLenum depthFunc = GL_LESS;
+};
+
+enum class SortOrder
+{
+    StateFirst,  // fewest state changes, depth only orders items sharing program and texture
+    DepthFirst   // strictly front to back, fewest shaded fragments
+};
+
+// Sort key layout, most significant first:
+//   StateFirst: 63..60 pass | 59..52 program | 51..40 material/texture | 39..24 depth bucket | 23..0 item index
+//   DepthFirst: 63..60 pass | 59..44 depth bucket | 43..36 program | 35..24 material/texture | 23..0 item index
+// The queue fills in the item index, it is carried along by the sort but never sorted on. program is a
+// Shader::sortIndex and material a Material, both small and dense: GL names grow with every hot reload and would
+// collide once masked.
+inline uint64_t makeSortKey(RenderPass pass, unsigned int program, unsigned int material, float depth, float maxDepth,
+                            SortOrder order = SortOrder::StateFirst)
+{
+    const float normalized = std::clamp(depth / maxDepth, 0.0f, 1.0f);
+    const auto depthBucket = static_cast<uint64_t>(normalized * 65535.0f);
+    const uint64_t passBits = (static_cast<uint64_t>(pass) & 0xF) << 60;
+    if (order == SortOrder::DepthFirst)
+    {
+        return passBits | depthBucket << 44 | (static_cast<uint64_t>(program) & 0xFF) << 36 |
+               (static_cast<uint64_t>(material) & 0xFFF) << 24;
+    }
+    return passBits | (static_cast<uint64_t>(program) & 0xFF) << 52 | (static_cast<uint64_t>(material) & 0xFFF) << 40 |
+           depthBucket << 24;
+}
+
+inline RenderPass sortKeyPass(uint64_t key) { return static_cast<RenderPass>(key >> 60); }
+
+const uint64_t sortKeyIndexBits = 24;
+const uint64_t sortKeyIndexMask = (uint64_t{1} << sortKeyIndexBits) - 1;
+
+struct DrawItem
+{
+    uint64_t key;
+    Shader* shader;
+    GLuint vertexArray;
+    GLuint texture;
+    GLsizei indexCount;
+    GLsizei instanceCount;  // 0 issues a plain glDrawElements
+    const mat4* model;      // nullptr leaves the model uniform untouched
+    GLuint condition;       // occlusion query to render conditionally on, 0 draws unconditionally
+};
+
+// LSD radix sort on the 8-bit digits above the item index. A first pass finds which digits actually differ between
+// keys, only those get a histogram and a scatter pass, so keys that vary in a few fields cost a few passes.
+inline void radixSort(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch)
+{
+    const size_t count = keys.size();
+    if (count < 2)
+    {
+        return;
+    }
+    scratch.resize(count);
+
+    uint64_t anyBits = 0;
+    uint64_t allBits = ~uint64_t{0};
+    for (auto key : keys)
+    {
+        anyBits |= key;
+        allBits &= key;
+    }
+    const uint64_t varying = (anyBits ^ allBits) & ~sortKeyIndexMask;
+
+    int digits[8];
+    int digitCount = 0;
+    for (int digit = 0; digit < 8; digit++)
+    {
+        if ((varying >> (digit * 8)) & 0xFF)
+        {
+            digits[digitCount++] = digit;
+        }
+    }
+
+    uint32_t histograms[8][256] = {};
+    for (auto key : keys)
+    {
+        for (int i = 0; i < digitCount; i++)
+        {
+            histograms[i][(key >> (digits[i] * 8)) & 0xFF]++;
+        }
+    }
+
+    uint64_t* src = keys.data();
+    uint64_t* dst = scratch.data();
+    for (int i = 0; i < digitCount; i++)
+    {
+        const int shift = digits[i] * 8;
+        uint32_t offsets[256];
+        uint32_t sum = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            offsets[bucket] = sum;
+            sum += histograms[i][bucket];
+        }
+        for (size_t j = 0; j < count; j++)
+        {
+            dst[offsets[(src[j] >> shift) & 0xFF]++] = src[j];
+        }
+        std::swap(src, dst);
+    }
+
+    if (src != keys.data())
+    {
+        std::copy(src, src + count, keys.data());
+    }
+}
+
+// Collects draw items for a frame, sorts them by key and submits them, skipping binds that match the previous
+// item. Storage is kept between frames so steady-state frames do not allocate.
+//
+// With workers set, the CPU side of a frame spreads over the thread pool in two places: record() fills the items
+// of separate scene partitions in parallel, and submission splits the sorted range into one chunk per thread, each
+// encoded into its own CommandBuffer. The GL thread then only replays those buffers back to back. Item order and
+// therefore the GL command stream are the same as with a single thread, apart from the binds repeated at chunk
+// boundaries that the state cache drops.
+class RenderQueue
+{
+public:
+    struct Stats
+    {
+        unsigned long items = 0;
+        unsigned long draws = 0;
+        unsigned long programChanges = 0;
+        unsigned long vertexArrayChanges = 0;
+        unsigned long textureChanges = 0;
+        unsigned long conditionalDraws = 0;
+        unsigned long commandBuffers = 0;
+        double sortMs = 0.0;
+        double recordMs = 0.0;
+        double encodeMs = 0.0;
+        double replayMs = 0.0;
+    };
+
+    // Fills the items of one scene partition, on whichever thread record() gave it to
+    class Recorder
+    {
+    public:
+        void push(const DrawItem& item) { items.push_back(item); }
+
+    private:
+        friend class RenderQueue;
+        std::vector<DrawItem> items;
+    };
+
+    // Record and encode on up to threads threads of pool, nullptr keeps everything on the calling thread
+    void setWorkers(ThreadPool* workerPool, unsigned int threads)
+    {
+        pool = workerPool;
+        workerThreads = pool ? std::clamp(threads, 1u, pool->size()) : 1;
+    }
+
+    unsigned int threads() const { return workerThreads; }
+
+    void clear()
+    {
+        items.clear();
+        keys.clear();
+    }
+
+    void push(const DrawItem& item)
+    {
+        keys.push_back((item.key & ~sortKeyIndexMask) | items.size());
+        items.push_back(item);
+    }
+
+    // Split [0, count) into one contiguous partition per thread and run job(first, last, recorder) for each.
+    // Partitions are appended in order, the queue ends up as if one loop had pushed the whole range.
+    void record(unsigned int count, const std::function<void(unsigned int, unsigned int, Recorder&)>& job)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        const unsigned int partitions = std::clamp(count / minPartitionItems, 1u, workerThreads);
+        if (recorders.size() < partitions)
+            recorders.resize(partitions);
+        parallel(partitions,
+                 [&](unsigned int partition)
+                 {
+                     auto& recorder = recorders[partition];
+                     recorder.items.clear();
+                     job(static_cast<unsigned int>(uint64_t{count} * partition / partitions),
+                         static_cast<unsigned int>(uint64_t{count} * (partition + 1) / partitions), recorder);
+                 });
+        for (unsigned int partition = 0; partition < partitions; partition++)
+        {
+            for (const auto& item : recorders[partition].items)
+                push(item);
+        }
+        stats.recordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void sort()
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        radixSort(keys, scratch);
+        stats.sortMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // State each pass is drawn with, the opaque pass switches to GL_EQUAL without depth writes after a pre-pass
+    void setPassState(RenderPass pass, const PassState& state) { passStates[static_cast<size_t>(pass)] = state; }
+
+    // Issue every item in key order. Binds go through the state cache, the counters here measure how well the sort
+    // grouped items rather than how many calls reached the driver, whatever the number of chunks.
+    void submit() { submit(keys.begin(), keys.end()); }
+
+    // Issue only the items of one pass, for callers that need to do something between passes. Needs sort() first.
+    void submit(RenderPass pass)
+    {
+        const auto first = std::lower_bound(keys.begin(), keys.end(), static_cast<uint64_t>(pass) << 60);
+        auto last = keys.end();
+        if (static_cast<uint64_t>(pass) + 1 < static_cast<uint64_t>(RenderPass::Count))
+            last = std::lower_bound(first, keys.end(), (static_cast<uint64_t>(pass) + 1) << 60);
+        submit(first, last);
+    }
+
+    // Counters summed since the caller last reset them
+    Stats stats;
+
+private:
+    // Below these an extra thread costs more to wake than it saves
+    static constexpr unsigned int minPartitionItems = 256;
+    static constexpr size_t minChunkItems = 512;
+
+    void parallel(unsigned int count, const std::function<void(unsigned int)>& job)
+    {
+        if (pool && count > 1)
+        {
+            pool->parallelFor(count, job);
+            return;
+        }
+        for (unsigned int i = 0; i < count; i++)
+            job(i);
+    }
+
+    void submit(std::vector<uint64_t>::const_iterator first, std::vector<uint64_t>::const_iterator last)
+    {
+        const size_t count = last - first;
+        if (count == 0)
+        {
+            return;
+        }
+
+        const auto encodeBegin = std::chrono::steady_clock::now();
+        const auto chunks = static_cast<unsigned int>(std::clamp<size_t>(count / minChunkItems, 1, workerThreads));
+        if (commandBuffers.size() < chunks)
+        {
+            commandBuffers.resize(chunks);
+            chunkStats.resize(chunks);
+        }
+        parallel(chunks,
+                 [&](unsigned int chunk)
+                 {
+                     chunkStats[chunk] = {};
+                     encode(first, first + count * chunk / chunks, first + count * (chunk + 1) / chunks,
+                            commandBuffers[chunk], chunkStats[chunk]);
+                 });
+        for (unsigned int chunk = 0; chunk < chunks; chunk++)
+        {
+            const auto& chunkStat = chunkStats[chunk];
+            stats.draws += chunkStat.draws;
+            stats.programChanges += chunkStat.programChanges;
+            stats.vertexArrayChanges += chunkStat.vertexArrayChanges;
+            stats.textureChanges += chunkStat.textureChanges;
+            stats.conditionalDraws += chunkStat.conditionalDraws;
+        }
+        const auto replayBegin = std::chrono::steady_clock::now();
+        stats.encodeMs += std::chrono::duration<double, std::milli>(replayBegin - encodeBegin).count();
+
+        for (unsigned int chunk = 0; chunk < chunks; chunk++)
+            commandBuffers[chunk].replay();
+
+        // Back to the defaults so whatever draws after the queue finds the state it expects
+        glState.colorMask(true);
+        glState.depthMask(true);
+        glState.depthFunc(GL_LESS);
+
+        stats.items += count;
+        stats.commandBuffers += chunks;
+        stats.replayMs +=
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replayBegin).count();
+    }
+
+    // Translate [first, last) into commands. Every buffer starts from unknown state and binds everything its first
+    // item needs, the counters compare against the item before it in key order so they do not depend on where the
+    // chunks were cut. rangeFirst is the start of the whole submitted range.
+    void encode(std::vector<uint64_t>::const_iterator rangeFirst, std::vector<uint64_t>::const_iterator first,
+                std::vector<uint64_t>::const_iterator last, CommandBuffer& buffer, Stats& counters) const
+    {
+        buffer.clear();
+        Shader* shader = nullptr;
+        GLuint vertexArray = 0;
+        GLuint texture = 0;
+        int pass = -1;
+        bool bound = false;
+
+        for (auto it = first; it != last; ++it)
+        {
+            const auto key = *it;
+            const auto& item = items[key & sortKeyIndexMask];
+            const DrawItem* previous = it != rangeFirst ? &items[*(it - 1) & sortKeyIndexMask] : nullptr;
+            if (static_cast<int>(sortKeyPass(key)) != pass)
+            {
+                pass = static_cast<int>(sortKeyPass(key));
+                const auto& state = passStates[pass];
+                buffer.setPassState(state.colorWrite, state.depthWrite, state.depthFunc);
+            }
+            if (!bound || item.shader != shader)
+            {
+                shader = item.shader;
+                buffer.bindProgram(shader);
+            }
+            if (!bound || item.vertexArray != vertexArray)
+            {
+                vertexArray = item.vertexArray;
+                buffer.bindVertexArray(vertexArray);
+            }
+            if (!bound || item.texture != texture)
+            {
+                texture = item.texture;
+                buffer.bindTexture(0, texture);
+            }
+            bound = true;
+            if (!previous || previous->shader != item.shader)
+                counters.programChanges++;
+            if (!previous || previous->vertexArray != item.vertexArray)
+                counters.vertexArrayChanges++;
+            if (!previous || previous->texture != item.texture)
+                counters.textureChanges++;
+
+            if (item.model)
+            {
+                buffer.setModel(*item.model);
+            }
+            buffer.draw(item.indexCount, item.instanceCount, item.condition);
+            if (item.condition)
+                counters.conditionalDraws++;
+            counters.draws++;
+        }
+    }
+
+    PassState passStates[static_cast<size_t>(RenderPass::Count)] = {{false, true, GL_LESS}, {true, true, GL_LESS}};
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> scratch;
+    std::vector<Recorder> recorders;
+    std::vector<CommandBuffer> commandBuffers;
+    std::vector<Stats> chunkStats;
+    ThreadPool* pool = nullptr;
+    unsigned int workerThreads = 1;
+};
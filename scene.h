@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "math.h"
+
+// Materials double as indices into the texture table built by main.
+enum Material : unsigned int
+{
+    MaterialWall = 0,
+    MaterialFloor = 1,
+    MaterialCount
+};
+
+// A unit quad placed in the world. All corridor geometry is static.
+struct Renderable
+{
+    mat4 model;
+    Material material;
+};
+
+// Length of a corridor segment along -z, one pair of side walls each.
+const float corridorSegmentLength = 5.0f;
+
+// Build a corridor with the given number of segments, closed by a far and a near wall. Seven segments give
+// the original hand-placed level.
+inline std::vector<Renderable> buildCorridor(int segments)
+{
+    std::vector<Renderable> scene;
+    scene.reserve(segments * 2 + 4);
+
+    const float length = segments * corridorSegmentLength;
+    mat4 model{1.0f};
+
+    /////////////////////////  WALLS /////////////////////////
+    for (int i = 0; i < segments; i++)
+    {
+        // Left wall
+        model = mat4{1.0f};
+        model = translate(model, vec3{-0.3f, 0.8f, i * -corridorSegmentLength});
+        model = rotate(model, radians(90.0f), vec3{0, 1.0f, 0});
+        model = scale(model, vec3{5.0f, 5.5f, 0});
+        scene.push_back({model, MaterialWall});
+
+        // Right wall
+        model = translate(model, vec3{10.0f, 0.8f, i * -corridorSegmentLength});
+        scene.push_back({model, MaterialWall});
+    }
+    // Far wall
+    model = mat4{1.0f};
+    model = translate(model, vec3{4.5f, 0.8f, 3.0f - length});
+    model = scale(model, vec3{12.0f, 5.5f, 1.0f});
+    scene.push_back({model, MaterialWall});
+
+    // Near wall
+    model = mat4{1.0f};
+    model = translate(model, vec3{4.5f, 0.8f, 1.0f});
+    model = scale(model, vec3{12.0f, 5.5f, 1.0f});
+    scene.push_back({model, MaterialWall});
+    //////////////////////////////////////////////////////////
+
+    /////////////////////////  CEILING ///////////////////////
+    model = mat4{1.0f};
+    model = translate(model, vec3{4.5f, 3.5f, 1.5f - length / 2});
+    model = rotate(model, radians(-90.f), vec3{1.0f, 0, 0});
+    model = scale(model, vec3{12.0f, length + 5.0f, 1.0f});
+    scene.push_back({model, MaterialFloor});
+    //////////////////////////////////////////////////////////
+
+    /////////////////////////  FLOOR /////////////////////////
+    model = mat4{1.0f};
+    model = translate(model, vec3{4.5f, -1.0f, 1.5f - length / 2});
+    model = rotate(model, radians(-90.0f), vec3{1.0f, 0, 0});
+    model = scale(model, vec3{12.0f, length - 0.5f, 1.0f});
+    scene.push_back({model, MaterialFloor});
+    /////////////////////////////////////////////////////////
+
+    return scene;
+}
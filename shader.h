@@ -2,119 +2,373 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
+#include <cstring>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
+#include "gl_ext.h"
+#include "gl_state.h"
 #include "math.h"
+#include "vfs.h"
+
+struct UniformStats
+{
+    unsigned long issued = 0;
+    unsigned long skipped = 0;
+};
 
 class Shader
 {
 public:
+    // A uniform of one program resolved ahead of time, setting through it skips the name lookup. Only valid with
+    // the Shader that handed it out, and it survives hot reloads.
+    struct UniformSlot
+    {
+        int index = -1;
+    };
+
     unsigned int ID;
+    // small dense number of this Shader for sort keys, unlike ID it stays put when hot reload swaps the program
+    const unsigned int sortIndex = nextSortIndex++;
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string computePath;
+    // files spliced in by #include, a change to any of them rebuilds the program like its own sources
+    std::vector<std::string> includePaths;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
-    {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-        }
-        catch (std::ifstream::failure& e)
+    Shader(const char* vertexPath, const char* fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+        // 1. retrieve the vertex/fragment source code, embedded in the binary or from disk in dev builds
+        auto vertexCode = openAsset(vertexPath);
+        auto fragmentCode = openAsset(fragmentPath);
+        // 2. compile shaders
+        ID = compile(expandIncludes(vertexCode.text(), openAsset, &includePaths),
+                     expandIncludes(fragmentCode.text(), openAsset, &includePaths));
+    }
+    // compute-only program, needs a GL 4.3 context
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath) : computePath(computePath)
+    {
+        auto computeCode = openAsset(computePath);
+        ID = compileCompute(expandIncludes(computeCode.text(), openAsset, &includePaths));
+    }
+    // splice every `#include "file"` line with the file's contents, read through load: openAsset, or the disk when
+    // reloading. GLSL has no includes of its own, this keeps code several programs share, like the clustered
+    // lighting, in one file. Includes do not nest. Paths spliced in are added to included.
+    // ------------------------------------------------------------------------
+    template <typename Load>
+    static std::string expandIncludes(std::string_view source, Load &&load,
+                                      std::vector<std::string> *included = nullptr)
+    {
+        std::string expanded;
+        expanded.reserve(source.size());
+        int line = 1;
+        while (!source.empty())
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            const size_t end = source.find('\n');
+            const std::string_view text = source.substr(0, end);
+            source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+            line++;
+
+            const size_t directive = text.find_first_not_of(" \t");
+            const size_t open = text.find('"');
+            const size_t close = text.rfind('"');
+            if (directive == std::string_view::npos || text.substr(directive, 8) != "#include" || open == close)
+            {
+                expanded.append(text);
+                expanded += '\n';
+                continue;
+            }
+
+            const std::string path{text.substr(open + 1, close - open - 1)};
+            auto code = load(path);
+            if (!code)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << path << std::endl;
+            }
+            expanded.append(code.text());
+            // Compile errors after the include still report the including file's line numbers
+            expanded += "\n#line " + std::to_string(line) + "\n";
+            if (included && std::find(included->begin(), included->end(), path) == included->end())
+            {
+                included->push_back(path);
+            }
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
+        return expanded;
+    }
+    // compile and link a program, returns 0 if any stage failed. Safe to call from any thread with a current
+    // context, the asset watcher uses it to build replacement programs on its shared context.
+    // ------------------------------------------------------------------------
+    static unsigned int compile(std::string_view vertexCode, std::string_view fragmentCode)
+    {
+        const char* vShaderCode = vertexCode.data();
+        const char * fShaderCode = fragmentCode.data();
+        const GLint vShaderLength = vertexCode.size();
+        const GLint fShaderLength = fragmentCode.size();
+        unsigned int vertex, fragment, program;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        bool ok = checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        ok = checkCompileErrors(fragment, "FRAGMENT") && ok;
         // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glLinkProgram(program);
+        ok = checkCompileErrors(program, "PROGRAM") && ok;
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
 
+        if (!ok)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+    // compile and link a compute program, returns 0 on failure
+    // ------------------------------------------------------------------------
+    static unsigned int compileCompute(std::string_view computeCode)
+    {
+        const char* cShaderCode = computeCode.data();
+        const GLint cShaderLength = computeCode.size();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, &cShaderLength);
+        glCompileShader(compute);
+        bool ok = checkCompileErrors(compute, "COMPUTE");
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, compute);
+        glLinkProgram(program);
+        ok = checkCompileErrors(program, "PROGRAM") && ok;
+        glDeleteShader(compute);
+
+        if (!ok)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+    // replace the program with an already linked one, the old program is deleted. Shadowed uniform values
+    // survive the swap and are re-sent to the new program on the next use().
+    // ------------------------------------------------------------------------
+    void swapProgram(unsigned int program)
+    {
+        glState.forgetProgram(ID);
+        glDeleteProgram(ID);
+        ID = program;
+        for (auto &[name, index] : slotsByName)
+        {
+            uniforms[index].location = glGetUniformLocation(ID, name.c_str());
+            uniforms[index].dirty = true;
+        }
     }
-    // activate the shader
+    // activate the shader and send any uniform set while it was not bound
     // ------------------------------------------------------------------------
-    void use() const
+    void use()
     { 
-        glUseProgram(ID); 
+        glState.useProgram(ID);
+        for (auto &uniform : uniforms)
+        {
+            if (uniform.dirty)
+                upload(uniform);
+        }
+    }
+    // resolve name once for setters called per draw, the string overloads below look it up on every call
+    // ------------------------------------------------------------------------
+    UniformSlot uniform(const std::string &name)
+    {
+        auto it = slotsByName.find(name);
+        if (it == slotsByName.end())
+        {
+            it = slotsByName.emplace(name, static_cast<int>(uniforms.size())).first;
+            uniforms.push_back(Uniform{});
+            uniforms.back().location = glGetUniformLocation(ID, name.c_str());
+        }
+        return UniformSlot{it->second};
     }
-    // utility uniform functions
+    // utility uniform functions. Values are shadowed per program, setting the value a uniform already holds
+    // costs a compare instead of a driver call.
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(const std::string &name, bool value)
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        int v = value;
+        set(name, UniformKind::Int, &v, 1);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const std::string &name, int value)
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        set(name, UniformKind::Int, &value, 1);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const std::string &name, float value)
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        set(name, UniformKind::Float, &value, 1);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const vec3 &value) const
+    void setVec2(const std::string &name, const vec2 &value)
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        const float v[2] = {value.x, value.y};
+        set(name, UniformKind::Vec2, v, 2);
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const vec4 &value) const
+    void setVec3(const std::string &name, const vec3 &value)
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        set(name, UniformKind::Vec3, &value[0], 3);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    // ------------------------------------------------------------------------
+    void setVec4(const std::string &name, const vec4 &value)
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        set(name, UniformKind::Vec4, &value[0], 4);
+    }
+    void setVec4(const std::string &name, float x, float y, float z, float w)
+    { 
+        setVec4(name, vec4{x, y, z, w});
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(const std::string &name, const mat4 &mat)
+    {
+        set(name, UniformKind::Mat4, &mat[0][0], 16);
+    }
+    // ------------------------------------------------------------------------
+    void setBool(UniformSlot slot, bool value)
+    {
+        int v = value;
+        set(slot, UniformKind::Int, &v, 1);
+    }
+    // ------------------------------------------------------------------------
+    void setInt(UniformSlot slot, int value)
+    {
+        set(slot, UniformKind::Int, &value, 1);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(UniformSlot slot, float value)
+    {
+        set(slot, UniformKind::Float, &value, 1);
+    }
+    // ------------------------------------------------------------------------
+    void setVec2(UniformSlot slot, const vec2 &value)
+    {
+        const float v[2] = {value.x, value.y};
+        set(slot, UniformKind::Vec2, v, 2);
+    }
+    // ------------------------------------------------------------------------
+    void setVec3(UniformSlot slot, const vec3 &value)
+    {
+        set(slot, UniformKind::Vec3, &value[0], 3);
+    }
+    // ------------------------------------------------------------------------
+    void setVec4(UniformSlot slot, const vec4 &value)
+    {
+        set(slot, UniformKind::Vec4, &value[0], 4);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const mat4 &mat) const 
+    void setMat4(UniformSlot slot, const mat4 &mat)
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        set(slot, UniformKind::Mat4, &mat[0][0], 16);
     }
 
+    static inline unsigned int nextSortIndex = 0;
+
+    // glUniform* calls issued and skipped as redundant, summed over every program until reset by the caller
+    static inline UniformStats uniformStats;
+
 private:
+    enum class UniformKind
+    {
+        Int,
+        Float,
+        Vec2,
+        Vec3,
+        Vec4,
+        Mat4
+    };
+
+    struct Uniform
+    {
+        GLint location = -1;
+        UniformKind kind = UniformKind::Float;
+        // last value set, ints are stored bitwise
+        float value[16] = {};
+        bool dirty = true;
+    };
+
+    // Shadowed values indexed by UniformSlot, the name map is only consulted to hand out slots
+    std::vector<Uniform> uniforms;
+    std::unordered_map<std::string, int> slotsByName;
+
+    void set(const std::string &name, UniformKind kind, const void *value, size_t components)
+    {
+        set(uniform(name), kind, value, components);
+    }
+
+    void set(UniformSlot slot, UniformKind kind, const void *value, size_t components)
+    {
+        const size_t size = components * sizeof(float);
+        Uniform &uniform = uniforms[slot.index];
+
+        if (!uniform.dirty && uniform.kind == kind && std::memcmp(uniform.value, value, size) == 0)
+        {
+            uniformStats.skipped++;
+            return;
+        }
+
+        uniform.kind = kind;
+        std::memcpy(uniform.value, value, size);
+        uniform.dirty = true;
+        // uniforms can only be sent to the current program, the others wait for use()
+        if (glState.currentProgram() == ID)
+        {
+            upload(uniform);
+        }
+    }
+
+    void upload(Uniform &uniform)
+    {
+        const auto *f = uniform.value;
+        switch (uniform.kind)
+        {
+        case UniformKind::Int:
+        {
+            GLint i;
+            std::memcpy(&i, f, sizeof(i));
+            glUniform1i(uniform.location, i);
+            break;
+        }
+        case UniformKind::Float:
+            glUniform1f(uniform.location, f[0]);
+            break;
+        case UniformKind::Vec2:
+            glUniform2fv(uniform.location, 1, f);
+            break;
+        case UniformKind::Vec3:
+            glUniform3fv(uniform.location, 1, f);
+            break;
+        case UniformKind::Vec4:
+            glUniform4fv(uniform.location, 1, f);
+            break;
+        case UniformKind::Mat4:
+            glUniformMatrix4fv(uniform.location, 1, GL_FALSE, f);
+            break;
+        }
+        uniform.dirty = false;
+        uniformStats.issued++;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -136,5 +390,6 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
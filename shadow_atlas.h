@@ -0,0 +1,604 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "clustered_lights.h"
+#include "culling.h"
+#include "gl_state.h"
+#include "math.h"
+#include "shader.h"
+
+struct ShadowStats
+{
+    unsigned long shadowedLights = 0;
+    unsigned long tilesRendered = 0;
+    unsigned long tilesCached = 0;
+    unsigned long tilesDeferred = 0;
+    unsigned long tilesComposited = 0;
+    double ms = 0.0;
+};
+
+inline ShadowStats shadowStats;
+
+// Geometry drawn into shadow maps with the depth-only shader.
+struct ShadowCaster
+{
+    GLuint vertexArray;
+    GLsizei indexCount;
+    const mat4* model;
+    Bounds bounds;
+};
+
+// Point light shadows packed into one depth atlas. The lights covering the most screen get a cube map each, six
+// square tiles whose size follows that coverage, from 512 down to 64 texels. Tiles come from 512 texel pages, a
+// page holds tiles of a single size.
+//
+// Static casters are rendered into a cache atlas and only again when the light moves or gets new tiles, at most
+// tileBudget tiles per frame, oldest first; until then the previous depth is used. The atlas the shaders sample
+// is the cache with dynamic casters drawn on top: a tile is copied over whenever its cached depth changed or
+// dynamic casters touch it now or did last frame. A newly shadowed light casts shadows once all six faces exist.
+//
+// Faces are world aligned, so camera movement never invalidates anything. lighting.glsl mirrors the face layout.
+class ShadowAtlas
+{
+public:
+    static constexpr int atlasSize = 4096;
+    static constexpr int pageSize = 512;
+    static constexpr int minTileSize = 64;
+    static constexpr int maxShadowedLights = 16;
+    static constexpr float nearPlane = 0.05f;
+
+    // Texture units the shadow samplers use, after the clustered light buffers
+    static constexpr GLuint atlasUnit = 5;
+    static constexpr GLuint dataUnit = 6;
+
+    explicit ShadowAtlas(int tileBudget = 12) : tileBudget(tileBudget)
+    {
+        for (auto& page : pages)
+            page = {};
+
+        GLuint* const textures[2] = {&cacheTexture, &atlasTexture};
+        GLuint* const framebuffers[2] = {&cacheFramebuffer, &atlasFramebuffer};
+        for (int i = 0; i < 2; i++)
+        {
+            glGenTextures(1, textures[i]);
+            glState.bindTexture(atlasUnit, GL_TEXTURE_2D, *textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT,
+                         GL_UNSIGNED_SHORT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            // Hardware comparison, linear filtering then gives 2x2 PCF
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+            glGenFramebuffers(1, framebuffers[i]);
+            glState.bindFramebuffer(GL_FRAMEBUFFER, *framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, *textures[i], 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            }
+            // Everything lit until a tile is drawn
+            glState.depthMask(true);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &dataBuffer);
+        glGenTextures(1, &dataTexture);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, dataBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(data), nullptr, GL_STREAM_DRAW);
+        glState.bindTexture(dataUnit, GL_TEXTURE_BUFFER, dataTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, dataBuffer);
+    }
+
+    ~ShadowAtlas()
+    {
+        for (auto framebuffer : {cacheFramebuffer, atlasFramebuffer})
+            glState.forgetFramebuffer(framebuffer);
+        for (auto texture : {cacheTexture, atlasTexture, dataTexture})
+            glState.forgetTexture(texture);
+        glState.forgetBuffer(dataBuffer);
+        glDeleteFramebuffers(1, &cacheFramebuffer);
+        glDeleteFramebuffers(1, &atlasFramebuffer);
+        glDeleteTextures(1, &cacheTexture);
+        glDeleteTextures(1, &atlasTexture);
+        glDeleteTextures(1, &dataTexture);
+        glDeleteBuffers(1, &dataBuffer);
+    }
+
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    Shader& shader() { return depthShader; }
+
+    // Shadow slot of every light, -1 for unshadowed ones. Valid after update().
+    const std::vector<int>& slots() const { return readySlots; }
+
+    // Pick the shadowed lights, refresh tiles within the budget and composite dynamic casters. Leaves the default
+    // framebuffer bound, the caller restores its viewport.
+    void update(const std::vector<PointLight>& lights, const vec3& eye, const Frustum& frustum, float projScale,
+                const std::vector<ShadowCaster>& staticCasters, const std::vector<ShadowCaster>& dynamicCasters)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        frame++;
+
+        // A different light set (respawned lights) keeps nothing
+        if (lights.size() != lightSlots.size())
+        {
+            for (auto& slot : shadowSlots)
+                release(slot);
+            lightSlots.assign(lights.size(), -1);
+            readySlots.assign(lights.size(), -1);
+        }
+
+        selectLights(lights, eye, frustum, projScale);
+        refreshTiles(lights, staticCasters);
+        composite(dynamicCasters);
+        uploadData();
+
+        glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState.disable(GL_SCISSOR_TEST);
+        glState.disable(GL_POLYGON_OFFSET_FILL);
+        glState.colorMask(true);
+
+        for (auto& slot : shadowSlots)
+            shadowStats.shadowedLights += slot.ready ? 1 : 0;
+        shadowStats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // Bind the atlas and set the uniforms a lit shader reads, see lighting.glsl
+    void apply(Shader& shader, const mat4& viewToWorld, bool enabled)
+    {
+        glState.bindTexture(atlasUnit, GL_TEXTURE_2D, atlasTexture);
+        glState.bindTexture(dataUnit, GL_TEXTURE_BUFFER, dataTexture);
+        shader.setBool("shadows", enabled);
+        shader.setInt("shadowAtlas", atlasUnit);
+        shader.setInt("shadowData", dataUnit);
+        shader.setMat4("viewToWorld", viewToWorld);
+        shader.setFloat("shadowTexel", 1.0f / atlasSize);
+    }
+
+private:
+    static constexpr int pagesPerSide = atlasSize / pageSize;
+    static constexpr int pageCount = pagesPerSide * pagesPerSide;
+    // Per slot and face: tile rect, then the position the face was rendered from and its far plane
+    static constexpr int texelsPerSlot = 12;
+
+    struct Tile
+    {
+        int x = 0;
+        int y = 0;
+        int size = 0;
+    };
+
+    struct Face
+    {
+        Tile tile;
+        vec3 origin{0.0f};
+        float farPlane = 1.0f;
+        bool valid = false;           // cached static depth matches the light
+        unsigned long renderedAt = 0;
+        bool refreshed = false;       // static depth changed this frame
+        bool dynamicLastFrame = false;
+    };
+
+    struct Slot
+    {
+        int light = -1;
+        int size = 0;
+        bool ready = false;  // every face rendered at least once
+        Face faces[6];
+    };
+
+    struct Page
+    {
+        int size = 0;  // 0 while free
+        uint64_t used = 0;
+    };
+
+    // Camera looking down +x, -x, +y, -y, +z, -z. Up vectors avoid being parallel to the view direction.
+    static vec3 faceDirection(int face)
+    {
+        static const vec3 directions[6] = {vec3{1.0f, 0.0f, 0.0f},  vec3{-1.0f, 0.0f, 0.0f},
+                                           vec3{0.0f, 1.0f, 0.0f},  vec3{0.0f, -1.0f, 0.0f},
+                                           vec3{0.0f, 0.0f, 1.0f},  vec3{0.0f, 0.0f, -1.0f}};
+        return directions[face];
+    }
+    static vec3 faceUp(int face)
+    {
+        static const vec3 ups[6] = {vec3{0.0f, 1.0f, 0.0f},  vec3{0.0f, 1.0f, 0.0f}, vec3{0.0f, 0.0f, -1.0f},
+                                    vec3{0.0f, 0.0f, 1.0f},  vec3{0.0f, 1.0f, 0.0f}, vec3{0.0f, 1.0f, 0.0f}};
+        return ups[face];
+    }
+
+    static int tileSizeFor(float coverage)
+    {
+        if (coverage >= 0.5f)
+            return 512;
+        if (coverage >= 0.25f)
+            return 256;
+        if (coverage >= 0.1f)
+            return 128;
+        return minTileSize;
+    }
+
+    void selectLights(const std::vector<PointLight>& lights, const vec3& eye, const Frustum& frustum,
+                      float projScale)
+    {
+        // Fraction of the screen height the light's sphere spans. Lights already shadowed rank a little higher so
+        // two similar lights do not trade tiles every frame.
+        candidates.clear();
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const auto& light = lights[i];
+            if (!isVisible(frustum, Bounds{light.position, vec3{light.radius}}))
+            {
+                continue;
+            }
+            const float distance = (light.position - eye).magnitude();
+            const float coverage =
+                distance <= light.radius ? 1.0f : std::min(1.0f, light.radius * projScale / (distance - light.radius));
+            const float rank = lightSlots[i] >= 0 ? coverage * hysteresis : coverage;
+            candidates.push_back({coverage, rank, static_cast<int>(i)});
+        }
+        const size_t count = std::min<size_t>(candidates.size(), maxShadowedLights);
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const Candidate& a, const Candidate& b) { return a.rank > b.rank; });
+        candidates.resize(count);
+
+        // Drop lights that fell out of the set, move lights whose coverage changed well past their tile size
+        for (auto& slot : shadowSlots)
+        {
+            if (slot.light < 0)
+            {
+                continue;
+            }
+            const auto it = std::find_if(candidates.begin(), candidates.end(),
+                                         [&](const Candidate& c) { return c.light == slot.light; });
+            if (it == candidates.end())
+            {
+                release(slot);
+                continue;
+            }
+            const int size = tileSizeFor(it->coverage);
+            if (size == slot.size || (tileSizeFor(it->coverage * hysteresis) >= slot.size &&
+                                      tileSizeFor(it->coverage / hysteresis) <= slot.size))
+            {
+                continue;
+            }
+            // The old tiles stay until the new ones are allocated, a full atlas keeps the light where it is
+            Slot resized;
+            if (allocateFaces(resized, size))
+            {
+                const int light = slot.light;
+                release(slot);
+                slot = resized;
+                slot.light = light;
+                slot.size = size;
+                lightSlots[light] = static_cast<int>(&slot - shadowSlots);
+            }
+        }
+
+        for (const auto& candidate : candidates)
+        {
+            if (lightSlots[candidate.light] >= 0)
+            {
+                continue;
+            }
+            auto* slot = std::find_if(std::begin(shadowSlots), std::end(shadowSlots),
+                                      [](const Slot& s) { return s.light < 0; });
+            if (slot == std::end(shadowSlots))
+            {
+                break;
+            }
+            // Fall back to smaller tiles when the atlas is full
+            for (int size = tileSizeFor(candidate.coverage); size >= minTileSize && slot->light < 0; size /= 2)
+            {
+                if (allocateFaces(*slot, size))
+                {
+                    slot->light = candidate.light;
+                    slot->size = size;
+                    lightSlots[candidate.light] = static_cast<int>(slot - shadowSlots);
+                }
+            }
+        }
+    }
+
+    void refreshTiles(const std::vector<PointLight>& lights, const std::vector<ShadowCaster>& casters)
+    {
+        // Faces whose light moved are stale, they keep being sampled until their turn comes
+        dirty.clear();
+        for (int s = 0; s < maxShadowedLights; s++)
+        {
+            auto& slot = shadowSlots[s];
+            if (slot.light < 0)
+            {
+                continue;
+            }
+            const auto& light = lights[slot.light];
+            for (int f = 0; f < 6; f++)
+            {
+                auto& face = slot.faces[f];
+                face.refreshed = false;
+                if (face.valid && ((face.origin - light.position).magnitude() > moveThreshold ||
+                                   face.farPlane != light.radius))
+                    face.valid = false;
+                if (face.valid)
+                    shadowStats.tilesCached++;
+                else
+                    dirty.push_back({s, f});
+            }
+        }
+
+        // Lights without shadows yet first, then the longest stale faces
+        std::sort(dirty.begin(), dirty.end(),
+                  [this](const DirtyFace& a, const DirtyFace& b)
+                  {
+                      const auto& slotA = shadowSlots[a.slot];
+                      const auto& slotB = shadowSlots[b.slot];
+                      if (slotA.ready != slotB.ready)
+                          return !slotA.ready;
+                      return slotA.faces[a.face].renderedAt < slotB.faces[b.face].renderedAt;
+                  });
+        const size_t refreshCount = std::min<size_t>(dirty.size(), tileBudget);
+        shadowStats.tilesDeferred += dirty.size() - refreshCount;
+        if (!refreshCount)
+        {
+            return;
+        }
+
+        glState.bindFramebuffer(GL_FRAMEBUFFER, cacheFramebuffer);
+        beginDepthPass();
+        for (size_t i = 0; i < refreshCount; i++)
+        {
+            auto& slot = shadowSlots[dirty[i].slot];
+            auto& face = slot.faces[dirty[i].face];
+            const auto& light = lights[slot.light];
+            face.origin = light.position;
+            face.farPlane = light.radius;
+            drawFace(face, dirty[i].face, casters);
+            face.valid = true;
+            face.refreshed = true;
+            face.renderedAt = frame;
+            shadowStats.tilesRendered++;
+        }
+        for (auto& slot : shadowSlots)
+        {
+            if (slot.light >= 0 && !slot.ready)
+                slot.ready = std::all_of(std::begin(slot.faces), std::end(slot.faces),
+                                         [](const Face& face) { return face.renderedAt > 0; });
+        }
+    }
+
+    void composite(const std::vector<ShadowCaster>& casters)
+    {
+        bool bound = false;
+        for (auto& slot : shadowSlots)
+        {
+            if (slot.light < 0)
+            {
+                continue;
+            }
+            for (int f = 0; f < 6; f++)
+            {
+                auto& face = slot.faces[f];
+                if (!face.renderedAt)
+                {
+                    continue;
+                }
+                const auto frustum = extractFrustum(faceViewProj(face, f));
+                bool dynamic = false;
+                for (const auto& caster : casters)
+                    dynamic = dynamic || isVisible(frustum, caster.bounds);
+                if (!face.refreshed && !dynamic && !face.dynamicLastFrame)
+                {
+                    continue;
+                }
+                face.dynamicLastFrame = dynamic;
+
+                // Static depth first, dynamic casters depth test against it. Blits are scissored, hence the disable.
+                const auto& t = face.tile;
+                glState.bindFramebuffer(GL_READ_FRAMEBUFFER, cacheFramebuffer);
+                glState.bindFramebuffer(GL_DRAW_FRAMEBUFFER, atlasFramebuffer);
+                glState.disable(GL_SCISSOR_TEST);
+                glBlitFramebuffer(t.x, t.y, t.x + t.size, t.y + t.size, t.x, t.y, t.x + t.size, t.y + t.size,
+                                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                if (dynamic)
+                {
+                    if (!bound)
+                    {
+                        beginDepthPass();
+                        bound = true;
+                    }
+                    drawFace(face, f, casters, false);
+                    shadowStats.tilesComposited++;
+                }
+            }
+        }
+    }
+
+    void beginDepthPass()
+    {
+        glState.enable(GL_DEPTH_TEST);
+        glState.depthFunc(GL_LESS);
+        glState.depthMask(true);
+        glState.colorMask(false);
+        // Walls are single quads, no back faces to cull; the slope bias keeps grazing walls from self-shadowing
+        glState.enable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.0f);
+        depthShader.use();
+    }
+
+    mat4 faceViewProj(const Face& face, int f) const
+    {
+        auto proj = perspective(radians(90.0f), 1.0f, nearPlane, face.farPlane);
+        return proj * lookAt(face.origin, face.origin + faceDirection(f), faceUp(f));
+    }
+
+    // Render the casters into the face's tile of the bound framebuffer, clearing it first for static casters
+    void drawFace(const Face& face, int f, const std::vector<ShadowCaster>& casters, bool clear = true)
+    {
+        const auto& t = face.tile;
+        glState.viewport(t.x, t.y, t.size, t.size);
+        glState.enable(GL_SCISSOR_TEST);
+        glScissor(t.x, t.y, t.size, t.size);
+        if (clear)
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+        const auto frustum = extractFrustum(faceViewProj(face, f));
+        depthShader.setMat4("proj", perspective(radians(90.0f), 1.0f, nearPlane, face.farPlane));
+        depthShader.setMat4("view", lookAt(face.origin, face.origin + faceDirection(f), faceUp(f)));
+        depthShader.use();
+        for (const auto& caster : casters)
+        {
+            if (!isVisible(frustum, caster.bounds))
+            {
+                continue;
+            }
+            depthShader.setMat4(modelUniform, *caster.model);
+            glState.bindVertexArray(caster.vertexArray);
+            glDrawElements(GL_TRIANGLES, caster.indexCount, GL_UNSIGNED_INT, 0);
+        }
+    }
+
+    void uploadData()
+    {
+        for (int s = 0; s < maxShadowedLights; s++)
+        {
+            const auto& slot = shadowSlots[s];
+            for (int f = 0; f < 6; f++)
+            {
+                const auto& face = slot.faces[f];
+                const float scale = 1.0f / atlasSize;
+                data[s * texelsPerSlot + f * 2] = vec4{face.tile.x * scale, face.tile.y * scale,
+                                                       face.tile.size * scale, 0.0f};
+                data[s * texelsPerSlot + f * 2 + 1] = vec4{face.origin.x, face.origin.y, face.origin.z, face.farPlane};
+            }
+        }
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, dataBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(data), data, GL_STREAM_DRAW);
+
+        // Lights only sample their maps once every face exists
+        for (auto& slot : readySlots)
+            slot = -1;
+        for (int s = 0; s < maxShadowedLights; s++)
+        {
+            if (shadowSlots[s].light >= 0 && shadowSlots[s].ready)
+                readySlots[shadowSlots[s].light] = s;
+        }
+    }
+
+    bool allocateFaces(Slot& slot, int size)
+    {
+        for (int f = 0; f < 6; f++)
+        {
+            if (!allocateTile(size, slot.faces[f].tile))
+            {
+                for (int g = 0; g < f; g++)
+                    freeTile(slot.faces[g].tile);
+                return false;
+            }
+            slot.faces[f] = Face{slot.faces[f].tile};
+        }
+        return true;
+    }
+
+    bool allocateTile(int size, Tile& tile)
+    {
+        const int perSide = pageSize / size;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int p = 0; p < pageCount; p++)
+            {
+                auto& page = pages[p];
+                // Pages already holding this size first, then a free one
+                if ((pass == 0 && page.size != size) || (pass == 1 && page.size != 0))
+                {
+                    continue;
+                }
+                for (int i = 0; i < perSide * perSide; i++)
+                {
+                    if (page.used & (uint64_t{1} << i))
+                    {
+                        continue;
+                    }
+                    page.size = size;
+                    page.used |= uint64_t{1} << i;
+                    tile = {(p % pagesPerSide) * pageSize + (i % perSide) * size,
+                            (p / pagesPerSide) * pageSize + (i / perSide) * size, size};
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void freeTile(const Tile& tile)
+    {
+        auto& page = pages[(tile.y / pageSize) * pagesPerSide + tile.x / pageSize];
+        const int perSide = pageSize / tile.size;
+        const int i = ((tile.y % pageSize) / tile.size) * perSide + (tile.x % pageSize) / tile.size;
+        page.used &= ~(uint64_t{1} << i);
+        if (!page.used)
+            page.size = 0;
+    }
+
+    void release(Slot& slot)
+    {
+        if (slot.light < 0)
+        {
+            return;
+        }
+        for (auto& face : slot.faces)
+            freeTile(face.tile);
+        if (slot.light < static_cast<int>(lightSlots.size()))
+            lightSlots[slot.light] = -1;
+        slot = Slot{};
+    }
+
+    struct Candidate
+    {
+        float coverage;
+        float rank;
+        int light;
+    };
+
+    struct DirtyFace
+    {
+        int slot;
+        int face;
+    };
+
+    static constexpr float moveThreshold = 1e-3f;
+    static constexpr float hysteresis = 1.25f;
+
+    int tileBudget;
+    unsigned long frame = 0;
+    Slot shadowSlots[maxShadowedLights];
+    Page pages[pageCount];
+    std::vector<int> lightSlots;  // slot holding each light's tiles
+    std::vector<int> readySlots;  // the same for lights whose maps are complete
+    std::vector<Candidate> candidates;
+    std::vector<DirtyFace> dirty;
+    vec4 data[maxShadowedLights * texelsPerSlot];
+    Shader depthShader{"depth.vert", "depth.frag"};
+    // Set once per caster
+    Shader::UniformSlot modelUniform = depthShader.uniform("model");
+    GLuint cacheTexture = 0;
+    GLuint atlasTexture = 0;
+    GLuint cacheFramebuffer = 0;
+    GLuint atlasFramebuffer = 0;
+    GLuint dataBuffer = 0;
+    GLuint dataTexture = 0;
+};
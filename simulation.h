@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "clustered_lights.h"
+#include "culling.h"
+#include "math.h"
+
+struct SimulationStats
+{
+    unsigned long steps = 0;
+    double stepMs = 0.0;
+    // Part of stepMs that ran while the render thread was busy with a frame
+    double overlapMs = 0.0;
+    // Frames that found no new snapshot and rendered the previous one again
+    unsigned long staleFrames = 0;
+};
+
+inline SimulationStats simulationStats;
+
+// Three slots passed between one writer and one reader without locks. The writer fills its back slot and publish()
+// swaps it with the middle one, the reader's acquire() swaps the middle with its front slot when something new was
+// published. Neither side ever touches a slot the other owns, and the reader always gets the newest finished value
+// while older unread ones are simply overwritten.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side
+    T& back() { return slots[backIndex]; }
+
+    void publish()
+    {
+        backIndex = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader side, false if nothing was published since the last acquire and front() is unchanged
+    bool acquire()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit))
+        {
+            return false;
+        }
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr unsigned int indexMask = 3;
+    static constexpr unsigned int freshBit = 4;
+
+    T slots[3];
+    unsigned int backIndex = 0;
+    std::atomic<unsigned int> middle{1};
+    unsigned int frontIndex = 2;
+};
+
+// Input for one simulation step, sampled on the main thread since GLFW only answers input queries there
+struct SimulationInput
+{
+    std::chrono::steady_clock::time_point sampled;
+    float deltaTime = 0.0f;
+    bool forward = false;
+    bool backward = false;
+    bool left = false;
+    bool right = false;
+    bool jump = false;
+    float yaw = -90.0f;
+    float pitch = 0.0f;
+    float fov = 45.0f;
+    bool animateLights = true;
+    int lightCount = 0;
+};
+
+// Everything a frame renders that the simulation moves. A snapshot is never written again once published, the
+// render thread reads it while the next one is being built.
+struct FrameSnapshot
+{
+    using clock = std::chrono::steady_clock;
+
+    unsigned long step = 0;
+    vec3 cameraPos;
+    vec3 cameraFront;
+    vec3 cameraUp;
+    float fov = 45.0f;
+    std::vector<PointLight> lights;
+    // When the input this step ran on was sampled
+    clock::time_point inputSampled;
+    clock::time_point stepBegin;
+    clock::time_point stepEnd;
+};
+
+// The camera mechanics and the drifting lights, stepped once per frame. Threaded, advance() hands the render thread
+// the snapshot stepped during the previous frame and starts the next step on the simulation thread, so simulating
+// frame N + 1 overlaps rendering frame N at the cost of a frame of latency. Inline, advance() steps on the calling
+// thread and returns the result straight away, which is the old single-threaded loop for debugging.
+class Simulation
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr float groundY = 0.5f;
+    static constexpr float jumpYLimit = 2.0f;
+    static constexpr float jumpVelocity = 4.5f;
+    static constexpr float cameraVelocity = 10.5f;
+
+    Simulation(const std::vector<Bounds>& lightAreas, const vec3& cameraPos)
+        : lightAreas(lightAreas), position(cameraPos)
+    {
+        // The first frame renders the starting state
+        SimulationInput initial;
+        initial.sampled = clock::now();
+        step(initial, snapshots.back());
+        snapshots.publish();
+    }
+
+    ~Simulation() { setThreaded(false); }
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    // Start or join the simulation thread, a step in flight finishes first
+    void setThreaded(bool enable)
+    {
+        if (enable == worker.joinable())
+        {
+            return;
+        }
+        if (enable)
+        {
+            quit = false;
+            worker = std::thread(&Simulation::run, this);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    bool threaded() const { return worker.joinable(); }
+
+    // Unit view direction for yaw and pitch in degrees
+    static vec3 facing(float yaw, float pitch)
+    {
+        vec3 dir{};
+        dir.x = std::cos(radians(yaw)) * std::cos(radians(pitch));
+        dir.y = std::sin(radians(pitch));
+        dir.z = std::sin(radians(yaw)) * std::cos(radians(pitch));
+        return dir.normalize();
+    }
+
+    // Render thread, once per frame before anything reads the camera. The returned snapshot stays valid until the
+    // next call.
+    const FrameSnapshot& advance(const SimulationInput& input)
+    {
+        if (threaded())
+        {
+            acquire();
+            renderBegin = clock::now();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                // Unclaimed input from a step that has not started yet still moves the camera
+                const float carried = hasPending ? pending.deltaTime : 0.0f;
+                pending = input;
+                pending.deltaTime += carried;
+                hasPending = true;
+            }
+            wake.notify_one();
+        }
+        else
+        {
+            step(input, snapshots.back());
+            snapshots.publish();
+            acquire();
+            renderBegin = clock::now();
+        }
+        return snapshots.front();
+    }
+
+    // Render thread, when the frame's work is submitted. Bounds the interval overlap is measured against.
+    void endFrame() { renderEnd = clock::now(); }
+
+private:
+    // Take the newest snapshot and account for the step that produced it
+    void acquire()
+    {
+        if (!snapshots.acquire())
+        {
+            simulationStats.staleFrames++;
+            return;
+        }
+        const auto& snapshot = snapshots.front();
+        simulationStats.steps++;
+        simulationStats.stepMs += std::chrono::duration<double, std::milli>(snapshot.stepEnd - snapshot.stepBegin)
+                                      .count();
+        // Threaded, the step ran during the last frame
+        const auto overlapBegin = std::max(snapshot.stepBegin, renderBegin);
+        const auto overlapEnd = std::min(snapshot.stepEnd, renderEnd);
+        if (overlapEnd > overlapBegin)
+        {
+            simulationStats.overlapMs += std::chrono::duration<double, std::milli>(overlapEnd - overlapBegin).count();
+        }
+    }
+
+    void run()
+    {
+        SimulationInput input;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return hasPending || quit; });
+                if (!hasPending)
+                {
+                    return;
+                }
+                input = pending;
+                hasPending = false;
+            }
+            step(input, snapshots.back());
+            snapshots.publish();
+        }
+    }
+
+    // Advance the world by input.deltaTime and write the result to snapshot, simulation state is only touched here
+    void step(const SimulationInput& input, FrameSnapshot& snapshot)
+    {
+        snapshot.stepBegin = clock::now();
+        const float deltaTime = input.deltaTime;
+
+        front = facing(input.yaw, input.pitch);
+
+        if (input.jump)
+        {
+            if (!jumping && position.y == groundY)
+            {
+                jumping = true;
+            }
+        }
+        // Other keys do nothing while jumping or falling
+        else if (!jumping && position.y <= groundY)
+        {
+            const float cameraSpeed = cameraVelocity * deltaTime;
+            auto cameraRight = front.cross(up).normalize();
+            if (input.forward)
+                position += cameraSpeed * front;
+            if (input.backward)
+                position -= cameraSpeed * front;
+            if (input.left)
+                position -= cameraRight * cameraSpeed;
+            if (input.right)
+                position += cameraRight * cameraSpeed;
+            position.y = groundY;
+        }
+
+        // Jumping
+        if (jumping)
+        {
+            position.y += jumpVelocity * deltaTime;
+            if (position.y >= jumpYLimit)
+            {
+                jumping = false;
+            }
+        }
+        // Falling, landing exactly on the ground
+        if (!jumping && position.y > groundY)
+        {
+            position.y = std::max(position.y - jumpVelocity * deltaTime, groundY);
+        }
+
+        if (input.lightCount != spawnedLights)
+        {
+            lightField.spawn(input.lightCount, lightAreas);
+            spawnedLights = input.lightCount;
+        }
+        if (input.animateLights)
+            lightTime += deltaTime;
+        lightField.animate(lightTime);
+
+        snapshot.step = steps++;
+        snapshot.cameraPos = position;
+        snapshot.cameraFront = front;
+        snapshot.cameraUp = up;
+        snapshot.fov = input.fov;
+        snapshot.lights = lightField.all();
+        snapshot.inputSampled = input.sampled;
+        snapshot.stepEnd = clock::now();
+    }
+
+    // Simulation state, owned by whichever thread steps
+    std::vector<Bounds> lightAreas;
+    LightField lightField;
+    int spawnedLights = 0;
+    float lightTime = 0.0f;
+    vec3 position;
+    vec3 front{0.0f, 0.0f, -1.0f};
+    const vec3 up{0.0f, 1.0f, 0.0f};
+    bool jumping = false;
+    unsigned long steps = 0;
+
+    TripleBuffer<FrameSnapshot> snapshots;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    SimulationInput pending;
+    bool hasPending = false;
+    bool quit = false;
+
+    // Render thread only, the last frame's submission
+    clock::time_point renderBegin;
+    clock::time_point renderEnd;
+};
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "culling.h"
+#include "math.h"
+#include "mesh.h"
+#include "thread_pool.h"
+
+struct SoftwareOcclusionStats
+{
+    unsigned long triangles = 0;
+    unsigned long tested = 0;
+    unsigned long occluded = 0;
+    double rasterMs = 0.0;
+    double testMs = 0.0;
+};
+
+inline SoftwareOcclusionStats softwareOcclusionStats;
+
+// CPU occlusion culling that never waits on GPU queries. Occluder triangles are rasterized into a small depth buffer,
+// tiles in parallel and 8 pixels at a time, then reduced into a max-depth mip chain (Hi-Z). An occludee's screen
+// rectangle is tested against the level where it covers at most 2x2 texels: it is hidden when its nearest depth lies
+// behind the farthest occluder depth in every one of them.
+//
+// Pixels count as covered when their center is, so occluders come out slightly larger than they are. Only surfaces
+// that fill their outline (walls) should be used as occluders.
+class SoftwareOcclusion
+{
+public:
+    static constexpr int width = 256;
+    static constexpr int height = 128;
+
+    SoftwareOcclusion(ThreadPool& pool) : pool(pool)
+    {
+        for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2))
+        {
+            levels.push_back({w, h, std::vector<float>(w * h, 1.0f)});
+            if (w == 1 && h == 1)
+                break;
+        }
+    }
+
+    // Start a frame, occluders added afterwards are projected with viewProj
+    void begin(const mat4& viewProj)
+    {
+        this->viewProj = viewProj;
+        triangles.clear();
+    }
+
+    void addOccluder(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const mat4& model)
+    {
+        const mat4 transform = viewProj * model;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            vec4 clip[3];
+            for (int k = 0; k < 3; k++)
+            {
+                const auto& v = vertices[indices[i + k]];
+                clip[k] = transform * vec4{v.x, v.y, v.z, 1.0f};
+            }
+            addTriangle(clip);
+        }
+    }
+
+    // Clear, rasterize every occluder and build the Hi-Z chain
+    void rasterize()
+    {
+        const auto begin = std::chrono::steady_clock::now();
+
+        pool.parallelFor(tilesX * tilesY, [this](unsigned int tile) { rasterizeTile(tile); });
+
+        for (size_t level = 1; level < levels.size(); level++)
+        {
+            const auto& src = levels[level - 1];
+            auto& dst = levels[level];
+            for (int y = 0; y < dst.height; y++)
+            {
+                const int y0 = std::min(2 * y, src.height - 1);
+                const int y1 = std::min(2 * y + 1, src.height - 1);
+                for (int x = 0; x < dst.width; x++)
+                {
+                    const int x0 = std::min(2 * x, src.width - 1);
+                    const int x1 = std::min(2 * x + 1, src.width - 1);
+                    dst.depth[y * dst.width + x] =
+                        std::max(std::max(src.depth[y0 * src.width + x0], src.depth[y0 * src.width + x1]),
+                                 std::max(src.depth[y1 * src.width + x0], src.depth[y1 * src.width + x1]));
+                }
+            }
+        }
+
+        softwareOcclusionStats.triangles += triangles.size();
+        softwareOcclusionStats.rasterMs +=
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // Conservative, anything crossing the near plane or leaving the screen counts as visible
+    bool isOccluded(const Bounds& bounds) const
+    {
+        float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, nearest = INFINITY;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const vec4 p{bounds.center.x + (corner & 1 ? bounds.extents.x : -bounds.extents.x),
+                         bounds.center.y + (corner & 2 ? bounds.extents.y : -bounds.extents.y),
+                         bounds.center.z + (corner & 4 ? bounds.extents.z : -bounds.extents.z), 1.0f};
+            const auto clip = viewProj * p;
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+            {
+                return false;
+            }
+            const float inverseW = 1.0f / clip.w;
+            const float x = (clip.x * inverseW * 0.5f + 0.5f) * width;
+            const float y = (clip.y * inverseW * 0.5f + 0.5f) * height;
+            minX = std::fmin(minX, x);
+            maxX = std::fmax(maxX, x);
+            minY = std::fmin(minY, y);
+            maxY = std::fmax(maxY, y);
+            nearest = std::fmin(nearest, clip.z * inverseW * 0.5f + 0.5f);
+        }
+        if (minX < 0.0f || minY < 0.0f || maxX >= width || maxY >= height)
+        {
+            return false;
+        }
+
+        const int x0 = static_cast<int>(minX), x1 = static_cast<int>(maxX);
+        const int y0 = static_cast<int>(minY), y1 = static_cast<int>(maxY);
+        size_t level = 0;
+        while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            level++;
+
+        const auto& hiz = levels[level];
+        for (int y = y0 >> level; y <= std::min(y1 >> level, hiz.height - 1); y++)
+        {
+            for (int x = x0 >> level; x <= std::min(x1 >> level, hiz.width - 1); x++)
+            {
+                if (hiz.depth[y * hiz.width + x] >= nearest)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Drop every occluded index from visible, order is kept. Tested in parallel chunks.
+    void cull(const std::vector<Bounds>& bounds, std::vector<unsigned int>& visible)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+
+        const unsigned int count = static_cast<unsigned int>(visible.size());
+        const unsigned int chunks = std::min(pool.size() * 4, (count + minChunk - 1) / minChunk);
+        occluded.assign(count, 0);
+        pool.parallelFor(chunks,
+                         [&](unsigned int chunk)
+                         {
+                             const unsigned int first = count * chunk / chunks;
+                             const unsigned int last = count * (chunk + 1) / chunks;
+                             for (unsigned int i = first; i < last; i++)
+                                 occluded[i] = isOccluded(bounds[visible[i]]);
+                         });
+
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (!occluded[i])
+                visible[kept++] = visible[i];
+        }
+        visible.resize(kept);
+
+        softwareOcclusionStats.tested += count;
+        softwareOcclusionStats.occluded += count - kept;
+        softwareOcclusionStats.testMs +=
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+private:
+    static constexpr int tileWidth = 64;
+    static constexpr int tileHeight = 32;
+    static constexpr int tilesX = width / tileWidth;
+    static constexpr int tilesY = height / tileHeight;
+    static constexpr unsigned int minChunk = 256;
+
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<float> depth;
+    };
+
+    // Screen-space triangle set up for rasterization: inside where all three edge functions a * x + b * y + c are
+    // non-negative, depth is a plane over the screen.
+    struct Triangle
+    {
+        float a[3], b[3], c[3];
+        float depthX, depthY, depthC;
+        int minX, minY, maxX, maxY;  // exclusive max
+    };
+
+    // Clip against the near plane first, the remaining vertices all have w > 0 and can be projected
+    void addTriangle(const vec4* clip)
+    {
+        vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const auto& a = clip[i];
+            const auto& b = clip[(i + 1) % 3];
+            const float da = a.z + a.w;
+            const float db = b.z + b.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                polygon[count++] = a + (b - a) * (da / (da - db));
+        }
+        if (count < 3)
+        {
+            return;
+        }
+
+        vec3 screen[4];
+        for (int i = 0; i < count; i++)
+        {
+            const float inverseW = 1.0f / std::max(polygon[i].w, 1e-6f);
+            screen[i] = vec3{(polygon[i].x * inverseW * 0.5f + 0.5f) * width,
+                             (polygon[i].y * inverseW * 0.5f + 0.5f) * height, polygon[i].z * inverseW * 0.5f + 0.5f};
+        }
+        for (int i = 1; i + 1 < count; i++)
+            setupTriangle(screen[0], screen[i], screen[i + 1]);
+    }
+
+    void setupTriangle(const vec3& v0, const vec3& v1, const vec3& v2)
+    {
+        const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (std::fabs(area) < 1e-8f)
+        {
+            return;
+        }
+
+        Triangle triangle;
+        const vec3* v[3] = {&v0, &v1, &v2};
+        // Occluders are double sided, flip clockwise triangles so inside is always non-negative
+        const float sign = area > 0.0f ? 1.0f : -1.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            const auto& from = *v[i];
+            const auto& to = *v[(i + 1) % 3];
+            triangle.a[i] = -(to.y - from.y) * sign;
+            triangle.b[i] = (to.x - from.x) * sign;
+            triangle.c[i] = -(triangle.a[i] * from.x + triangle.b[i] * from.y);
+        }
+
+        triangle.depthX = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+        triangle.depthY = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+        triangle.depthC = v0.z - triangle.depthX * v0.x - triangle.depthY * v0.y;
+
+        triangle.minX = std::max(0, static_cast<int>(std::floor(std::fmin(v0.x, std::fmin(v1.x, v2.x)))));
+        triangle.minY = std::max(0, static_cast<int>(std::floor(std::fmin(v0.y, std::fmin(v1.y, v2.y)))));
+        triangle.maxX = std::min(width, static_cast<int>(std::ceil(std::fmax(v0.x, std::fmax(v1.x, v2.x)))));
+        triangle.maxY = std::min(height, static_cast<int>(std::ceil(std::fmax(v0.y, std::fmax(v1.y, v2.y)))));
+        if (triangle.minX >= triangle.maxX || triangle.minY >= triangle.maxY)
+        {
+            return;
+        }
+        triangles.push_back(triangle);
+    }
+
+    void rasterizeTile(unsigned int tile)
+    {
+        const int tileX = static_cast<int>(tile % tilesX) * tileWidth;
+        const int tileY = static_cast<int>(tile / tilesX) * tileHeight;
+        auto& depth = levels[0].depth;
+
+        for (int y = tileY; y < tileY + tileHeight; y++)
+            std::fill_n(depth.data() + y * width + tileX, tileWidth, 1.0f);
+
+        for (const auto& triangle : triangles)
+        {
+            // Spans start on a multiple of 8 so every step covers one aligned group of pixels inside the tile
+            const int minX = std::max(triangle.minX, tileX) & ~7;
+            const int maxX = std::min(triangle.maxX, tileX + tileWidth);
+            const int minY = std::max(triangle.minY, tileY);
+            const int maxY = std::min(triangle.maxY, tileY + tileHeight);
+            for (int y = minY; y < maxY; y++)
+            {
+                float* row = depth.data() + y * width;
+                for (int x = minX; x < maxX; x += 8)
+                    rasterizeSpan(triangle, row, x, y);
+            }
+        }
+    }
+
+    // Depth test and write 8 pixels starting at x in one row
+    static void rasterizeSpan(const Triangle& t, float* row, int x, int y)
+    {
+        const float py = y + 0.5f;
+#if defined(__AVX__)
+        const __m256 px = _mm256_add_ps(_mm256_set1_ps(x + 0.5f), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int i = 0; i < 3; i++)
+        {
+            const __m256 edge = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[i]), px),
+                                              _mm256_set1_ps(t.b[i] * py + t.c[i]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(edge, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        if (_mm256_movemask_ps(inside) == 0)
+        {
+            return;
+        }
+        const __m256 z =
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.depthX), px), _mm256_set1_ps(t.depthY * py + t.depthC));
+        const __m256 current = _mm256_loadu_ps(row + x);
+        _mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+#else
+        // Same as the AVX path one lane at a time, simple enough for the compiler to vectorize with SSE
+        for (int lane = 0; lane < 8; lane++)
+        {
+            const float px = x + lane + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 3; i++)
+                inside &= t.a[i] * px + t.b[i] * py + t.c[i] >= 0.0f;
+            const float z = t.depthX * px + t.depthY * py + t.depthC;
+            if (inside && z < row[x + lane])
+                row[x + lane] = z;
+        }
+#endif
+    }
+
+    ThreadPool& pool;
+    mat4 viewProj{1.0f};
+    std::vector<Triangle> triangles;
+    std::vector<Level> levels;
+    std::vector<unsigned char> occluded;
+};
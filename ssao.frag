@@ -0,0 +1,83 @@
+#version 330 core
+
+in vec2 TexCoord;
+
+out vec2 Occlusion;  // ambient visibility, linear depth for the blur and the next frame
+
+uniform sampler2D linearDepth;
+uniform sampler2D history;
+uniform vec2 lowSize;       // pixels this pass covers
+uniform vec2 depthScale;    // lowSize over the texture size
+uniform vec2 projScale;     // proj[0][0], proj[1][1]
+uniform float radius;
+uniform float intensity;
+uniform float frameOffset;  // moves the rotation pattern every frame while accumulating
+uniform bool temporal;
+uniform mat4 reprojection;  // view space to last frame's clip space
+uniform vec2 historyScale;  // last frame's lowSize over the texture size
+
+const float bias = 0.02;
+
+// Hemisphere around +z, longer towards the end so most samples stay close to the surface
+const int kernelSize = 8;
+const vec3 kernel[kernelSize] = vec3[kernelSize](
+    vec3(0.263, 0.103, 0.117), vec3(-0.188, 0.237, 0.175), vec3(-0.281, -0.236, 0.122), vec3(0.175, -0.372, 0.295),
+    vec3(0.527, 0.228, 0.310), vec3(-0.431, 0.510, 0.260), vec3(-0.359, -0.454, 0.633), vec3(0.378, -0.187, 0.878));
+
+vec3 viewPosition(vec2 uv)
+{
+    uv = clamp(uv, 0.5 / lowSize, 1.0 - 0.5 / lowSize);
+    float viewDistance = texture(linearDepth, uv * depthScale).r;
+    return vec3((uv * 2.0 - 1.0) * viewDistance / projScale, -viewDistance);
+}
+
+float interleavedGradientNoise(vec2 position)
+{
+    return fract(52.9829189 * fract(dot(position, vec2(0.06711056, 0.00583715))));
+}
+
+void main()
+{
+    vec3 position = viewPosition(TexCoord);
+
+    // Normal from the neighbour on the side with the smaller depth step, so edges do not bend it
+    vec2 texel = 1.0 / lowSize;
+    vec3 right = viewPosition(TexCoord + vec2(texel.x, 0.0)) - position;
+    vec3 left = position - viewPosition(TexCoord - vec2(texel.x, 0.0));
+    vec3 up = viewPosition(TexCoord + vec2(0.0, texel.y)) - position;
+    vec3 down = position - viewPosition(TexCoord - vec2(0.0, texel.y));
+    vec3 normal = normalize(cross(abs(right.z) < abs(left.z) ? right : left, abs(up.z) < abs(down.z) ? up : down));
+
+    // Kernel rotated around the normal per pixel, the blur averages the pattern away
+    float angle = 6.2831853 * interleavedGradientNoise(gl_FragCoord.xy + frameOffset);
+    vec3 tangent = vec3(cos(angle), sin(angle), 0.0);
+    tangent = tangent - normal * dot(tangent, normal);
+    tangent = dot(tangent, tangent) > 1e-4 ? normalize(tangent) : normalize(cross(normal, vec3(0.0, 1.0, 0.0)));
+    mat3 basis = mat3(tangent, cross(normal, tangent), normal);
+
+    float occlusion = 0.0;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        vec3 probe = position + basis * kernel[i] * radius;
+        vec2 uv = probe.xy * projScale / -probe.z * 0.5 + 0.5;
+        float surface = -viewPosition(uv).z;
+        // Occluders far in front of the probe belong to something else, fade them out
+        float range = smoothstep(0.0, 1.0, radius / abs(-position.z - surface));
+        occlusion += (surface <= -probe.z - bias ? 1.0 : 0.0) * range;
+    }
+    float visibility = pow(1.0 - occlusion / kernelSize, intensity);
+
+    // Blend with last frame where it saw the same surface, its depth must match the reprojected one
+    if (temporal)
+    {
+        vec4 previous = reprojection * vec4(position, 1.0);
+        vec2 previousUV = previous.xy / previous.w * 0.5 + 0.5;
+        if (all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThanEqual(previousUV, vec2(1.0))))
+        {
+            vec2 past = texture(history, previousUV * historyScale).rg;
+            if (abs(past.y - previous.w) < 0.05 * previous.w)
+                visibility = mix(past.x, visibility, 0.25);
+        }
+    }
+    Occlusion = vec2(visibility, -position.z);
+}
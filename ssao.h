@@ -0,0 +1,264 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "dynamic_resolution.h"
+#include "gl_state.h"
+#include "gpu_timer.h"
+#include "math.h"
+#include "render_graph.h"
+#include "shader.h"
+
+struct SsaoStats
+{
+    double downsampleMs = 0.0;
+    double occlusionMs = 0.0;
+    double blurMs = 0.0;
+    double upsampleMs = 0.0;
+    unsigned long frames = 0;
+};
+
+inline SsaoStats ssaoStats;
+
+// Screen space ambient occlusion at half or quarter resolution. The scene depth is reduced to linear distances at
+// the low resolution, an 8 sample hemisphere kernel rotated per pixel estimates occlusion there, a separable
+// depth-aware blur removes the rotation noise and a bilateral upsample multiplies the result onto the scene colour.
+// With temporal accumulation the rotation changes every frame and each pixel blends with its reprojected value
+// from the previous frame, which keeps the kernel small for the same noise.
+//
+// The passes run on the frame's render graph and every one of them is timed with GPU timestamps. The intermediate
+// targets are graph transients, only the two occlusion textures that ping-pong as history while accumulating are
+// owned here. Those are sized for half of the scene target's allocation and only reallocate when it grows, quarter
+// resolution and lower render scales use a corner of them.
+class AmbientOcclusion
+{
+public:
+    enum Pass
+    {
+        Downsample,
+        Occlusion,
+        Blur,
+        Upsample,
+        PassCount
+    };
+
+    // Texture units of the pass inputs, nothing lit draws while the passes run
+    static constexpr GLuint depthUnit = 0;
+    static constexpr GLuint inputUnit = 1;
+    static constexpr GLuint historyUnit = 2;
+
+    AmbientOcclusion()
+    {
+        glGenTextures(2, historyTextures);
+        glGenVertexArrays(1, &emptyVAO);
+
+        downsampleShader.setInt("sceneDepth", depthUnit);
+        occlusionShader.setInt("linearDepth", inputUnit);
+        occlusionShader.setInt("history", historyUnit);
+        blurShader.setInt("occlusion", inputUnit);
+        upsampleShader.setInt("sceneDepth", depthUnit);
+        upsampleShader.setInt("occlusion", inputUnit);
+    }
+
+    ~AmbientOcclusion()
+    {
+        for (const GLuint texture : historyTextures)
+        {
+            glState.forgetTexture(texture);
+        }
+        glState.forgetVertexArray(emptyVAO);
+        glDeleteTextures(2, historyTextures);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    AmbientOcclusion(const AmbientOcclusion&) = delete;
+    AmbientOcclusion& operator=(const AmbientOcclusion&) = delete;
+
+    Shader& program(Pass pass)
+    {
+        Shader* const shaders[PassCount] = {&downsampleShader, &occlusionShader, &blurShader, &upsampleShader};
+        return *shaders[pass];
+    }
+
+    // Declare the passes that occlude color using depth, both imported from the scene target. view and proj are
+    // the unjittered camera, divisor is 2 or 4. The last pass darkens color in place.
+    void addPasses(RenderGraph& graph, RenderGraph::Resource color, RenderGraph::Resource depth,
+                   const SceneTarget& scene, const mat4& view, const mat4& proj, int divisor, bool temporal)
+    {
+        using Resource = RenderGraph::Resource;
+        const int lowWidth = (scene.width() + divisor - 1) / divisor;
+        const int lowHeight = (scene.height() + divisor - 1) / divisor;
+        const vec2 lowSize{static_cast<float>(lowWidth), static_cast<float>(lowHeight)};
+        const vec2 renderSize{static_cast<float>(scene.width()), static_cast<float>(scene.height())};
+        const vec2 depthParams{proj[2][2], proj[3][2]};
+        const RenderGraph::TextureDesc low{lowWidth, lowHeight, GL_RG16F};
+
+        const Resource linearDepth = graph.createTexture("ssao linear depth", {lowWidth, lowHeight, GL_R32F});
+        graph.addPass("ssao downsample", {depth}, {linearDepth},
+                      [=](RenderGraph::Context& context)
+                      {
+                          timer.begin();
+                          glState.disable(GL_DEPTH_TEST);
+                          glState.colorMask(true);
+                          glState.bindVertexArray(emptyVAO);
+                          context.bindTexture(depthUnit, depth);
+                          context.bindTarget(linearDepth);
+                          downsampleShader.setFloat("divisor", static_cast<float>(divisor));
+                          downsampleShader.setVec2("renderSize", renderSize);
+                          downsampleShader.setVec2("depthParams", depthParams);
+                          downsampleShader.use();
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+                          timer.mark(Downsample);
+                      });
+
+        // While accumulating, raw occlusion ping-pongs between the history textures and this frame's becomes next
+        // frame's history. Otherwise it is just another transient. The history is only usable if last frame
+        // accumulated at the same divisor, and it stays invalid unless the occlusion pass actually runs.
+        const bool accumulate = temporal && historyValid && divisor == historyDivisor;
+        historyValid = false;
+        Resource raw;
+        std::vector<Resource> occlusionReads{linearDepth};
+        if (temporal)
+        {
+            allocate(scene);
+            const int previous = current;
+            current = 1 - current;
+            raw = graph.importTexture("ssao occlusion", historyTextures[current], low, historyWidth, historyHeight);
+            occlusionReads.push_back(
+                graph.importTexture("ssao history", historyTextures[previous], low, historyWidth, historyHeight));
+        }
+        else
+        {
+            raw = graph.createTexture("ssao occlusion", low);
+        }
+        auto reprojection = previousViewProj * inverseRigid(view);
+        const vec2 previousScale = historyScale;
+        const GLuint history = historyTextures[1 - current];
+        const float frameOffset = temporal ? static_cast<float>(frame % 8) * 5.588238f : 0.0f;
+        graph.addPass("ssao occlusion", occlusionReads, {raw},
+                      [=](RenderGraph::Context& context)
+                      {
+                          context.bindTexture(inputUnit, linearDepth);
+                          glState.bindTexture(historyUnit, GL_TEXTURE_2D, history);
+                          context.bindTarget(raw);
+                          occlusionShader.setVec2("lowSize", lowSize);
+                          occlusionShader.setVec2("depthScale", context.uvScale(linearDepth));
+                          occlusionShader.setVec2("projScale", vec2{proj[0][0], proj[1][1]});
+                          occlusionShader.setFloat("radius", radius);
+                          occlusionShader.setFloat("intensity", intensity);
+                          occlusionShader.setFloat("frameOffset", frameOffset);
+                          occlusionShader.setBool("temporal", accumulate);
+                          occlusionShader.setMat4("reprojection", reprojection);
+                          occlusionShader.setVec2("historyScale", previousScale);
+                          occlusionShader.use();
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+                          timer.mark(Occlusion);
+
+                          auto viewProj = proj;
+                          previousViewProj = viewProj * view;
+                          historyScale = temporal ? context.uvScale(raw) : vec2{};
+                          historyDivisor = divisor;
+                          historyValid = temporal;
+                      });
+        frame++;
+
+        const Resource blurX = graph.createTexture("ssao blur x", low);
+        const Resource blurY = graph.createTexture("ssao blur y", low);
+        const Resource blurInputs[2] = {raw, blurX};
+        const Resource blurOutputs[2] = {blurX, blurY};
+        const char* const blurNames[2] = {"ssao blur x", "ssao blur y"};
+        for (int axis = 0; axis < 2; axis++)
+        {
+            const Resource input = blurInputs[axis];
+            const Resource output = blurOutputs[axis];
+            graph.addPass(blurNames[axis], {input}, {output},
+                          [=](RenderGraph::Context& context)
+                          {
+                              context.bindTexture(inputUnit, input);
+                              context.bindTarget(output);
+                              blurShader.setVec2("lowSize", lowSize);
+                              blurShader.setVec2("direction", axis == 0 ? vec2{1.0f, 0.0f} : vec2{0.0f, 1.0f});
+                              blurShader.use();
+                              glDrawArrays(GL_TRIANGLES, 0, 3);
+                              if (axis == 1)
+                                  timer.mark(Blur);
+                          });
+        }
+
+        // dst * src, the scene colour darkens by the visibility
+        graph.addPass("ssao upsample", {blurY, depth, color}, {color},
+                      [=](RenderGraph::Context& context)
+                      {
+                          context.bindTarget(color);
+                          glState.enable(GL_BLEND);
+                          glState.blendFunc(GL_ZERO, GL_SRC_COLOR);
+                          context.bindTexture(depthUnit, depth);
+                          context.bindTexture(inputUnit, blurY);
+                          upsampleShader.setVec2("depthParams", depthParams);
+                          upsampleShader.setFloat("divisor", static_cast<float>(divisor));
+                          upsampleShader.setVec2("lowSize", lowSize);
+                          upsampleShader.use();
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+                          glState.disable(GL_BLEND);
+                          glState.enable(GL_DEPTH_TEST);
+                          timer.mark(Upsample);
+                          timer.end();
+
+                          ssaoStats.downsampleMs += timer.lastMs(Downsample);
+                          ssaoStats.occlusionMs += timer.lastMs(Occlusion);
+                          ssaoStats.blurMs += timer.lastMs(Blur);
+                          ssaoStats.upsampleMs += timer.lastMs(Upsample);
+                          ssaoStats.frames++;
+                      });
+    }
+
+    // Drop the accumulated occlusion, called on frames without ambient occlusion
+    void reset() { historyValid = false; }
+
+private:
+    static constexpr float radius = 0.35f;
+    static constexpr float intensity = 1.5f;
+
+    void allocate(const SceneTarget& scene)
+    {
+        const int width = (scene.textureWidth() + 1) / 2;
+        const int height = (scene.textureHeight() + 1) / 2;
+        if (width <= historyWidth && height <= historyHeight)
+        {
+            return;
+        }
+        historyWidth = std::max(width, historyWidth);
+        historyHeight = std::max(height, historyHeight);
+        historyValid = false;
+
+        for (const GLuint texture : historyTextures)
+        {
+            glState.bindTexture(historyUnit, GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, historyWidth, historyHeight, 0, GL_RG, GL_FLOAT, nullptr);
+            // Every pass filters by hand, the hardware must not blend depths across edges
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    }
+
+    Shader downsampleShader{"fullscreen.vert", "ssao_downsample.frag"};
+    Shader occlusionShader{"fullscreen.vert", "ssao.frag"};
+    Shader blurShader{"fullscreen.vert", "ssao_blur.frag"};
+    Shader upsampleShader{"fullscreen.vert", "ssao_upsample.frag"};
+    GpuPassTimer timer{PassCount};
+    GLuint historyTextures[2] = {};
+    GLuint emptyVAO = 0;
+    int historyWidth = 0;
+    int historyHeight = 0;
+    int current = 0;
+    unsigned int frame = 0;
+    mat4 previousViewProj{1.0f};
+    vec2 historyScale;
+    int historyDivisor = 0;
+    bool historyValid = false;
+};
@@ -0,0 +1,29 @@
+#version 330 core
+
+out vec2 Occlusion;
+
+uniform sampler2D occlusion;
+uniform vec2 direction;  // one texel along x or y
+uniform vec2 lowSize;
+
+// Taps further than this fraction of the centre's distance belong to another surface
+const float depthTolerance = 0.05;
+
+// One axis of a separable 9 tap Gaussian that ignores samples across depth edges
+void main()
+{
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    ivec2 last = ivec2(lowSize) - 1;
+    vec2 middle = texelFetch(occlusion, center, 0).rg;
+
+    float sum = 0.0;
+    float total = 0.0;
+    for (int i = -4; i <= 4; i++)
+    {
+        vec2 tap = texelFetch(occlusion, clamp(center + ivec2(direction) * i, ivec2(0), last), 0).rg;
+        float weight = exp(-float(i * i) / 8.0) * max(0.0, 1.0 - abs(tap.y - middle.y) / (middle.y * depthTolerance));
+        sum += tap.x * weight;
+        total += weight;
+    }
+    Occlusion = vec2(sum / total, middle.y);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+out float LinearDepth;
+
+uniform sampler2D sceneDepth;
+uniform float divisor;
+uniform vec2 renderSize;
+uniform vec2 depthParams;  // proj[2][2], proj[3][2]
+
+// One depth per low resolution pixel, linearised so later passes compare distances directly. The nearest of the
+// 2x2 at the centre of the block keeps thin foreground edges from vanishing.
+void main()
+{
+    int block = int(divisor);
+    ivec2 base = ivec2(gl_FragCoord.xy) * block + block / 2 - 1;
+    ivec2 last = ivec2(renderSize) - 1;
+    float depth = 1.0;
+    for (int y = 0; y < 2; y++)
+    {
+        for (int x = 0; x < 2; x++)
+            depth = min(depth, texelFetch(sceneDepth, clamp(base + ivec2(x, y), ivec2(0), last), 0).r);
+    }
+    LinearDepth = depthParams.y / (depth * 2.0 - 1.0 + depthParams.x);
+}
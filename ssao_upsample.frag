@@ -0,0 +1,38 @@
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D sceneDepth;
+uniform sampler2D occlusion;
+uniform vec2 depthParams;  // proj[2][2], proj[3][2]
+uniform float divisor;
+uniform vec2 lowSize;
+
+// Bilateral upsample: bilinear weights over the four nearest low resolution pixels, each scaled down by how far
+// its depth is from this pixel's, so occlusion does not bleed across silhouettes. Multiplied onto the scene colour
+// by the blend state.
+void main()
+{
+    float depth = texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r;
+    float viewDistance = depthParams.y / (depth * 2.0 - 1.0 + depthParams.x);
+
+    vec2 lowPosition = gl_FragCoord.xy / divisor - 0.5;
+    ivec2 base = ivec2(floor(lowPosition));
+    vec2 f = lowPosition - vec2(base);
+    ivec2 last = ivec2(lowSize) - 1;
+
+    float sum = 0.0;
+    float total = 0.0;
+    for (int y = 0; y < 2; y++)
+    {
+        for (int x = 0; x < 2; x++)
+        {
+            vec2 tap = texelFetch(occlusion, clamp(base + ivec2(x, y), ivec2(0), last), 0).rg;
+            float bilinear = (x == 1 ? f.x : 1.0 - f.x) * (y == 1 ? f.y : 1.0 - f.y);
+            float weight = (bilinear + 0.001) / (0.01 + abs(tap.y - viewDistance) / viewDistance);
+            sum += tap.x * weight;
+            total += weight;
+        }
+    }
+    FragColor = vec4(vec3(sum / total), 1.0);
+}
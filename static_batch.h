@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <vector>
+
+#include "culling.h"
+#include "math.h"
+#include "mesh.h"
+#include "scene.h"
+
+// Static geometry merged into one pre-transformed mesh per material.
+struct StaticBatch
+{
+    Material material;
+    Mesh mesh;
+    Bounds bounds;
+};
+
+// Collects static meshes at level load, transforms their vertices on the CPU and merges everything sharing a
+// material into a single VBO/IBO, so static scenery costs one draw per material and no model uniform.
+class StaticBatchBuilder
+{
+public:
+    // World units covered by one texture repeat. Zero keeps the source UVs, which stretch the texture over each
+    // surface exactly like the per-object and instanced paths do.
+    float tileSize = 0.0f;
+
+    void add(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const mat4& transform,
+             Material material)
+    {
+        auto& batch = pending[material];
+        const auto base = static_cast<unsigned int>(batch.vertices.size());
+
+        // Surface extent along the mesh's local axes, used to repeat the texture instead of stretching it
+        const float uScale = tileSize > 0.0f ? length(transform[0]) / tileSize : 1.0f;
+        const float vScale = tileSize > 0.0f ? length(transform[1]) / tileSize : 1.0f;
+
+        for (const auto& vertex : vertices)
+        {
+            const auto p = transform * vec4{vertex.x, vertex.y, vertex.z, 1.0f};
+            batch.vertices.push_back({p.x, p.y, p.z, vertex.u * uScale, vertex.v * vScale});
+        }
+        for (auto index : indices)
+        {
+            batch.indices.push_back(base + index);
+        }
+    }
+
+    // Upload one mesh per material that received geometry and clear the builder.
+    std::vector<StaticBatch> build()
+    {
+        std::vector<StaticBatch> batches;
+        for (unsigned int material = 0; material < MaterialCount; material++)
+        {
+            auto& batch = pending[material];
+            if (batch.indices.empty())
+            {
+                continue;
+            }
+            batches.push_back({static_cast<Material>(material), createMesh(batch.vertices, batch.indices),
+                               computeBounds(batch.vertices)});
+            batch = {};
+        }
+        return batches;
+    }
+
+private:
+    struct Pending
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+    };
+
+    static float length(const vec4& v) { return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z); }
+
+    Pending pending[MaterialCount];
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "gl_ext.h"
+#include "gl_state.h"
+
+struct StreamStats
+{
+    unsigned long bytes = 0;
+    unsigned long allocations = 0;
+    unsigned long fenceWaits = 0;
+    double waitMs = 0.0;
+};
+
+inline StreamStats streamStats;
+
+// Sub-allocation of a StreamBuffer, valid for the frame it was made in.
+struct StreamAllocation
+{
+    GLuint buffer = 0;
+    GLintptr offset = 0;
+    GLsizeiptr size = 0;
+    void* data = nullptr;
+
+    explicit operator bool() const { return data != nullptr; }
+};
+
+// Ring allocator for data rewritten every frame: instance transforms, uniform blocks, storage buffers, vertices.
+//
+// With buffer storage the buffer is mapped once, persistent and coherent, and split into one region per frame in
+// flight. A frame writes into its region while the GPU still reads the previous ones, a fence per region makes sure
+// the region is free again before it is reused. Without it every frame orphans the buffer and maps it afresh, the
+// driver then hands out new memory instead of synchronizing.
+//
+// Per frame: beginFrame(), allocate() and fill, commit() before the draws that read the data, endFrame() after them.
+class StreamBuffer
+{
+public:
+    StreamBuffer(GLsizeiptr frameSize, int framesInFlight = 3)
+        : frameSize(frameSize), regions(glExt.persistentMapping ? std::min(framesInFlight, maxRegions) : 1)
+    {
+        glGenBuffers(1, &buffer);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (glExt.persistentMapping)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glExt.bufferStorage(GL_COPY_WRITE_BUFFER, frameSize * regions, nullptr, flags);
+            mapped =
+                static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameSize * regions, flags));
+        }
+        else
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+        }
+
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniformAlignment = std::max(alignment, 16);
+        alignment = 0;
+        if (glExt.computeAndIndirect)
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        storageAlignment = std::max(alignment, 16);
+    }
+
+    ~StreamBuffer()
+    {
+        for (auto& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (mapped)
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glState.forgetBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    bool persistent() const { return glExt.persistentMapping; }
+
+    // Offset alignment glBindBufferRange requires for each kind of binding
+    GLsizeiptr alignmentFor(GLenum target) const
+    {
+        if (target == GL_UNIFORM_BUFFER)
+            return uniformAlignment;
+        if (target == GL_SHADER_STORAGE_BUFFER)
+            return storageAlignment;
+        return 16;
+    }
+
+    // Make the next region writable, waits only if the GPU is still reading it
+    void beginFrame()
+    {
+        region = (region + 1) % regions;
+        head = 0;
+
+        if (!glExt.persistentMapping)
+        {
+            // Orphan: the driver detaches the old storage and hands out fresh memory
+            glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, frameSize, nullptr, GL_STREAM_DRAW);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(
+                GL_COPY_WRITE_BUFFER, 0, frameSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            return;
+        }
+
+        auto& fence = fences[region];
+        if (!fence)
+        {
+            return;
+        }
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            const auto begin = std::chrono::steady_clock::now();
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            streamStats.fenceWaits++;
+            streamStats.waitMs +=
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    // Returns an empty allocation once the frame's region is full, callers fall back to their own upload
+    StreamAllocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16)
+    {
+        if (!mapped)
+        {
+            return {};
+        }
+        const GLsizeiptr start = (head + alignment - 1) / alignment * alignment;
+        if (start + size > frameSize)
+        {
+            if (!warned)
+            {
+                std::cout << "WARNING::STREAM_BUFFER::OUT_OF_SPACE " << frameSize << " bytes per frame" << std::endl;
+                warned = true;
+            }
+            return {};
+        }
+        head = start + size;
+        streamStats.bytes += size;
+        streamStats.allocations++;
+
+        const GLintptr offset = (glExt.persistentMapping ? region * frameSize : 0) + start;
+        return {buffer, offset, size, mapped + offset};
+    }
+
+    // Bind an allocation to an indexed uniform or shader storage binding point
+    static void bindRange(GLenum target, GLuint index, const StreamAllocation& allocation)
+    {
+        glBindBufferRange(target, index, allocation.buffer, allocation.offset, allocation.size);
+    }
+
+    // Writes become visible to the GPU. Coherent mappings need nothing, the fallback has to unmap before drawing.
+    void commit()
+    {
+        if (glExt.persistentMapping || !mapped)
+        {
+            return;
+        }
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mapped = nullptr;
+    }
+
+    // Fence the region after the last command reading it
+    void endFrame()
+    {
+        if (glExt.persistentMapping)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    static constexpr int maxRegions = 4;
+
+    GLuint buffer = 0;
+    GLsizeiptr frameSize;
+    int regions;
+    int region = 0;
+    GLsizeiptr head = 0;
+    unsigned char* mapped = nullptr;
+    GLsync fences[maxRegions] = {};
+    GLsizeiptr uniformAlignment = 16;
+    GLsizeiptr storageAlignment = 16;
+    bool warned = false;
+};
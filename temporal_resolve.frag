@@ -0,0 +1,71 @@
+#version 330 core
+
+in vec2 TexCoord;
+
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+uniform sampler2D sceneDepth;
+uniform sampler2D velocity;
+uniform sampler2D history;
+uniform vec2 renderSize;    // pixels rendered this frame
+uniform vec2 upscale;       // window pixels per rendered pixel
+uniform vec2 historyScale;  // window size over the history texture size
+uniform vec2 jitter;        // pixel i holds the scene at i + 0.5 + jitter
+uniform float blend;
+uniform bool historyValid;
+
+// Clamping in luma and chroma keeps the box tight around the neighbourhood's actual colours
+vec3 toYCoCg(vec3 c)
+{
+    return vec3(0.25 * c.r + 0.5 * c.g + 0.25 * c.b, 0.5 * c.r - 0.5 * c.b, -0.25 * c.r + 0.5 * c.g - 0.25 * c.b);
+}
+
+vec3 fromYCoCg(vec3 c)
+{
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+void main()
+{
+    // The rendered pixel whose sample lies closest to this output pixel
+    vec2 renderPos = TexCoord * renderSize;
+    ivec2 last = ivec2(renderSize) - 1;
+    ivec2 nearest = clamp(ivec2(floor(renderPos - jitter)), ivec2(0), last);
+    vec2 offset = (renderPos - (vec2(nearest) + 0.5 + jitter)) * upscale;
+
+    // Neighbourhood bounds, and the nearest depth whose motion is used so edges follow the foreground
+    vec3 low = vec3(1e9);
+    vec3 high = vec3(-1e9);
+    float closest = 1.0;
+    ivec2 closestTexel = nearest;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            ivec2 texel = clamp(nearest + ivec2(x, y), ivec2(0), last);
+            vec3 color = toYCoCg(texelFetch(sceneColor, texel, 0).rgb);
+            low = min(low, color);
+            high = max(high, color);
+            float depth = texelFetch(sceneDepth, texel, 0).r;
+            if (depth < closest)
+            {
+                closest = depth;
+                closestTexel = texel;
+            }
+        }
+    }
+    vec3 current = toYCoCg(texelFetch(sceneColor, nearest, 0).rgb);
+
+    vec2 previousUV = TexCoord - texelFetch(velocity, closestTexel, 0).xy;
+    if (!historyValid || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0))))
+    {
+        FragColor = vec4(fromYCoCg(current), 1.0);
+        return;
+    }
+    vec3 previous = clamp(toYCoCg(texture(history, previousUV * historyScale).rgb), low, high);
+
+    // A sample far from the output pixel says little about it, it only nudges the history
+    float weight = exp(-2.29 * dot(offset, offset));
+    FragColor = vec4(fromYCoCg(mix(previous, current, blend * weight)), 1.0);
+}
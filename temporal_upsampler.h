@@ -0,0 +1,252 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+
+#include "dynamic_resolution.h"
+#include "gl_state.h"
+#include "math.h"
+#include "render_graph.h"
+#include "shader.h"
+
+struct TemporalStats
+{
+    unsigned long resolves = 0;
+    unsigned long historyResets = 0;
+};
+
+inline TemporalStats temporalStats;
+
+// Temporal upsampling: every frame renders at a reduced resolution through a projection shifted by a different
+// sub-pixel offset, and the resolve accumulates those samples into a history at window resolution. Over a jitter
+// cycle each output pixel sees samples from all over its footprint, which is where the detail comes from.
+//
+// The scene only moves with the camera, so motion comes from depth: a fullscreen pass rebuilds every pixel's view
+// position and projects it with the previous frame's view and projection into a velocity buffer. The resolve
+// follows that velocity into the history, clamps what it finds to the current frame's 3x3 neighbourhood so stale
+// or disoccluded history cannot ghost, and blends in the nearest new sample weighted by how close it lies to the
+// output pixel.
+//
+// Both passes run on the frame's render graph with the velocity buffer as a transient. The resolve writes a history
+// owned here, so it only runs while something reads that, usually addPresent() copying it to the screen. When
+// nothing does the graph culls both passes and the history starts over the next time they run. While upsampling is
+// off the passes are not declared at all and release() frees the history.
+class TemporalUpsampler
+{
+public:
+    static constexpr int jitterPhases = 8;
+
+    // Texture units of the resolve's inputs, nothing lit draws between the velocity pass and the resolve
+    static constexpr GLuint colorUnit = 0;
+    static constexpr GLuint depthUnit = 1;
+    static constexpr GLuint velocityUnit = 2;
+    static constexpr GLuint historyUnit = 3;
+
+    TemporalUpsampler()
+    {
+        glGenTextures(2, historyTextures);
+        glGenVertexArrays(1, &emptyVAO);
+
+        velocityShader.setInt("sceneDepth", depthUnit);
+        resolveShader.setInt("sceneColor", colorUnit);
+        resolveShader.setInt("sceneDepth", depthUnit);
+        resolveShader.setInt("velocity", velocityUnit);
+        resolveShader.setInt("history", historyUnit);
+    }
+
+    ~TemporalUpsampler()
+    {
+        for (const GLuint texture : historyTextures)
+        {
+            glState.forgetTexture(texture);
+        }
+        glState.forgetVertexArray(emptyVAO);
+        glDeleteTextures(2, historyTextures);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    TemporalUpsampler(const TemporalUpsampler&) = delete;
+    TemporalUpsampler& operator=(const TemporalUpsampler&) = delete;
+
+    Shader& velocityProgram() { return velocityShader; }
+    Shader& resolveProgram() { return resolveShader; }
+
+    // Advance the jitter sequence and return proj shifted by this frame's offset for a width x height render.
+    // Culling keeps the unjittered projection.
+    mat4 jitter(mat4 proj, int width, int height)
+    {
+        phase = (phase + 1) % jitterPhases;
+        // Halton(2, 3), centred on the pixel
+        offset = vec2{halton(phase + 1, 2) - 0.5f, halton(phase + 1, 3) - 0.5f};
+        // clip.w is -z, so adding to the z column moves the image by minus the offset in NDC: pixel i then holds
+        // the scene at i + 0.5 + offset
+        proj[2][0] += 2.0f * offset.x / width;
+        proj[2][1] += 2.0f * offset.y / height;
+        return proj;
+    }
+
+    // Declare the velocity pass and the resolve into the history. color and depth are the scene target's imports,
+    // view and proj this frame's unjittered camera. Returns the resolved history at window size.
+    RenderGraph::Resource addPasses(RenderGraph& graph, RenderGraph::Resource color, RenderGraph::Resource depth,
+                                    const SceneTarget& scene, const mat4& view, const mat4& proj, int windowWidth,
+                                    int windowHeight)
+    {
+        using Resource = RenderGraph::Resource;
+        windowWidth = std::max(windowWidth, 1);
+        windowHeight = std::max(windowHeight, 1);
+        allocate(windowWidth, windowHeight);
+
+        // Velocity of every rendered pixel, in window uv from last frame to this one
+        const vec2 renderSize{static_cast<float>(scene.width()), static_cast<float>(scene.height())};
+        const vec2 jitterOffset = offset;
+        auto reprojection = previousViewProj * inverseRigid(view);
+        const Resource velocity = graph.createTexture("velocity", {scene.width(), scene.height(), GL_RG16F});
+        graph.addPass("velocity", {depth}, {velocity},
+                      [=](RenderGraph::Context& context)
+                      {
+                          glState.disable(GL_DEPTH_TEST);
+                          glState.colorMask(true);
+                          glState.bindVertexArray(emptyVAO);
+                          context.bindTexture(depthUnit, depth);
+                          context.bindTarget(velocity);
+                          velocityShader.setVec4("projParams", vec4{proj[0][0], proj[1][1], proj[2][2], proj[3][2]});
+                          velocityShader.setMat4("reprojection", reprojection);
+                          velocityShader.setVec2("renderSize", renderSize);
+                          velocityShader.setVec2("jitter", jitterOffset);
+                          velocityShader.use();
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+                          glState.enable(GL_DEPTH_TEST);
+                      });
+
+        // Accumulate into the other history texture at window resolution. Until the resolve runs the history is
+        // invalid, a culled frame leaves it that way.
+        const int read = current;
+        current = 1 - current;
+        const RenderGraph::TextureDesc window{windowWidth, windowHeight, GL_RGBA16F};
+        const Resource previous =
+            graph.importTexture("history", historyTextures[read], window, historyWidth, historyHeight);
+        const Resource resolved =
+            graph.importTexture("resolved history", historyTextures[current], window, historyWidth, historyHeight);
+        const bool valid = historyValid;
+        historyValid = false;
+        graph.addPass("temporal resolve", {color, depth, velocity, previous}, {resolved},
+                      [=](RenderGraph::Context& context)
+                      {
+                          glState.disable(GL_DEPTH_TEST);
+                          glState.colorMask(true);
+                          glState.bindVertexArray(emptyVAO);
+                          context.bindTexture(colorUnit, color);
+                          context.bindTexture(depthUnit, depth);
+                          context.bindTexture(velocityUnit, velocity);
+                          context.bindTexture(historyUnit, previous);
+                          context.bindTarget(resolved);
+                          resolveShader.setVec2("renderSize", renderSize);
+                          resolveShader.setVec2("upscale",
+                                                vec2{windowWidth / renderSize.x, windowHeight / renderSize.y});
+                          resolveShader.setVec2("historyScale", context.uvScale(previous));
+                          resolveShader.setVec2("jitter", jitterOffset);
+                          resolveShader.setFloat("blend", blend);
+                          resolveShader.setBool("historyValid", valid);
+                          resolveShader.use();
+                          glDrawArrays(GL_TRIANGLES, 0, 3);
+                          glState.enable(GL_DEPTH_TEST);
+
+                          auto viewProj = proj;
+                          previousViewProj = viewProj * view;
+                          historyValid = true;
+                          temporalStats.resolves++;
+                          if (!valid)
+                              temporalStats.historyResets++;
+                      });
+        return resolved;
+    }
+
+    // Free the history's storage, the next addPasses() allocates it again and starts the accumulation over. The
+    // texture names stay, the render graph keeps framebuffers built over them.
+    void release()
+    {
+        if (historyWidth == 0)
+        {
+            return;
+        }
+        for (const GLuint texture : historyTextures)
+        {
+            glState.bindTexture(historyUnit, GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 0, 0, 0, GL_RGBA, GL_FLOAT, nullptr);
+        }
+        historyWidth = 0;
+        historyHeight = 0;
+        historyValid = false;
+    }
+
+    // Declare the copy of the resolved history to backbuffer, anything drawn after it is at native resolution
+    void addPresent(RenderGraph& graph, RenderGraph::Resource resolved, RenderGraph::Resource backbuffer,
+                    int windowWidth, int windowHeight)
+    {
+        graph.addPass("temporal present", {resolved}, {backbuffer},
+                      [=](RenderGraph::Context& context)
+                      {
+                          context.bindTarget(resolved);
+                          glState.bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+                          glBlitFramebuffer(0, 0, windowWidth, windowHeight, 0, 0, windowWidth, windowHeight,
+                                            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+                          glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+                      });
+    }
+
+private:
+    // Weight of the newest sample when it lands right on the output pixel, roughly a ten frame average
+    static constexpr float blend = 0.1f;
+
+    static float halton(int index, int base)
+    {
+        float result = 0.0f;
+        float fraction = 1.0f / base;
+        for (; index > 0; index /= base, fraction /= base)
+            result += fraction * (index % base);
+        return result;
+    }
+
+    // The history only grows with the window, a new window size invalidates it
+    void allocate(int windowWidth, int windowHeight)
+    {
+        if (windowWidth > historyWidth || windowHeight > historyHeight)
+        {
+            historyWidth = std::max(windowWidth, historyWidth);
+            historyHeight = std::max(windowHeight, historyHeight);
+            for (const GLuint texture : historyTextures)
+            {
+                glState.bindTexture(historyUnit, GL_TEXTURE_2D, texture);
+                // Half floats, at a tenth per frame 8 bits would leave accumulation stuck a few steps short
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, historyWidth, historyHeight, 0, GL_RGBA, GL_FLOAT,
+                             nullptr);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+        }
+
+        if (windowWidth != lastWindowWidth || windowHeight != lastWindowHeight)
+        {
+            lastWindowWidth = windowWidth;
+            lastWindowHeight = windowHeight;
+            historyValid = false;
+        }
+    }
+
+    Shader velocityShader{"fullscreen.vert", "velocity.frag"};
+    Shader resolveShader{"fullscreen.vert", "temporal_resolve.frag"};
+    GLuint historyTextures[2] = {};
+    GLuint emptyVAO = 0;
+    int historyWidth = 0;
+    int historyHeight = 0;
+    int lastWindowWidth = 0;
+    int lastWindowHeight = 0;
+    int current = 0;
+    int phase = 0;
+    vec2 offset;
+    mat4 previousViewProj{1.0f};
+    bool historyValid = false;
+};
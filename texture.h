@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <iostream>
+#include <string>
+
+#include "vfs.h"
+
+// Decoded image as returned by stb_image, kept apart from the upload so decoding can happen off the GL thread.
+struct Image
+{
+    unsigned char* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int nrChannels = 0;
+};
+
+inline Image decodeImage(const AssetData& asset, const std::string& path)
+{
+    Image image;
+    if (asset)
+    {
+        image.data = stbi_load_from_memory(asset.data, static_cast<int>(asset.size), &image.width, &image.height,
+                                           &image.nrChannels, 0);
+    }
+    if (!image.data)
+    {
+        std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD: " << path << std::endl;
+    }
+    return image;
+}
+
+inline void freeImage(Image& image)
+{
+    stbi_image_free(image.data);
+    image.data = nullptr;
+}
+
+// Create a repeating, mipmapped GL_TEXTURE_2D from a decoded image, returns 0 if the image is empty. Binds through
+// raw GL since the asset watcher calls this on its own context, callers on the main context invalidate glState.
+inline GLuint uploadTexture(const Image& image)
+{
+    if (!image.data)
+    {
+        return 0;
+    }
+
+    GLenum format = GL_RGB;
+    if (image.nrChannels == 1)
+        format = GL_RED;
+    if (image.nrChannels == 4)
+        format = GL_RGBA;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    return texture;
+}
+
+inline GLuint loadTexture(const AssetData& asset, const std::string& path)
+{
+    auto image = decodeImage(asset, path);
+    auto texture = uploadTexture(image);
+    freeImage(image);
+    return texture;
+}
+
+inline GLuint loadTexture(const std::string& path) { return loadTexture(openAsset(path), path); }
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for fork-join work inside a frame. parallelFor hands out job indices from an atomic
+// counter, the calling thread takes jobs too and the call returns once every job has finished.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int workers = std::max(1u, std::thread::hardware_concurrency()) - 1)
+    {
+        for (unsigned int i = 0; i < workers; i++)
+            threads.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads taking part in parallelFor, workers plus the caller
+    unsigned int size() const { return static_cast<unsigned int>(threads.size()) + 1; }
+
+    void parallelFor(unsigned int count, const std::function<void(unsigned int)>& job)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (threads.empty() || count == 1)
+        {
+            for (unsigned int i = 0; i < count; i++)
+                job(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            jobCount = count;
+            nextJob = 0;
+            remaining = count;
+            generation++;
+        }
+        wake.notify_all();
+
+        runJobs(job, count);
+
+        // Workers that joined late still hold the job, wait for them to let go before it goes out of scope
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return remaining == 0 && active == 0; });
+        current = nullptr;
+    }
+
+private:
+    void runJobs(const std::function<void(unsigned int)>& job, unsigned int count)
+    {
+        for (unsigned int i = nextJob++; i < count; i = nextJob++)
+        {
+            job(i);
+            remaining--;
+        }
+    }
+
+    void workerLoop()
+    {
+        unsigned long seen = 0;
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit)
+            {
+                return;
+            }
+            seen = generation;
+            // Woke up after the caller already finished everything
+            if (remaining == 0)
+            {
+                continue;
+            }
+            active++;
+            const auto* job = current;
+            const unsigned int count = jobCount;
+            lock.unlock();
+
+            runJobs(*job, count);
+
+            lock.lock();
+            active--;
+            done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(unsigned int)>* current = nullptr;
+    unsigned int jobCount = 0;
+    std::atomic<unsigned int> nextJob{0};
+    std::atomic<unsigned int> remaining{0};
+    unsigned int active = 0;
+    unsigned long generation = 0;
+    bool quit = false;
+};
@@ -0,0 +1,30 @@
+#version 330 core
+
+in vec2 TexCoord;
+
+out vec4 FragColor;
+
+uniform sampler2D scene;
+uniform vec2 uvScale;     // rendered size over the texture size
+uniform vec2 texelSize;   // one texel of the scene texture in uv
+uniform float sharpness;  // 0 is plain bilinear
+
+// Stay inside the rendered region, the rest of the texture holds stale pixels from larger frames
+vec3 fetch(vec2 uv)
+{
+    return texture(scene, clamp(uv, texelSize * 0.5, uvScale - texelSize * 0.5)).rgb;
+}
+
+void main()
+{
+    vec2 uv = TexCoord * uvScale;
+    vec3 color = fetch(uv);
+    if (sharpness > 0.0)
+    {
+        // Unsharp mask over the source texel cross, restores some of the detail bilinear filtering blurs away
+        vec3 blur = (fetch(uv + vec2(texelSize.x, 0.0)) + fetch(uv - vec2(texelSize.x, 0.0)) +
+                     fetch(uv + vec2(0.0, texelSize.y)) + fetch(uv - vec2(0.0, texelSize.y))) * 0.25;
+        color = clamp(color + (color - blur) * sharpness, 0.0, 1.0);
+    }
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+out vec2 Velocity;
+
+uniform sampler2D sceneDepth;
+uniform vec4 projParams;    // proj[0][0], proj[1][1], proj[2][2], proj[3][2] of the unjittered projection
+uniform mat4 reprojection;  // this frame's view space to last frame's clip space
+uniform vec2 renderSize;
+uniform vec2 jitter;        // pixel i holds the scene at i + 0.5 + jitter
+
+// Screen motion of the surface under each pixel, in uv. Only the camera moves, so depth is all it takes.
+void main()
+{
+    float depth = texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r;
+    vec2 uv = (gl_FragCoord.xy + jitter) / renderSize;
+
+    // The jitter only shears x and y, depth inverts through the plain projection
+    vec3 ndc = vec3(uv, depth) * 2.0 - 1.0;
+    float viewZ = -projParams.w / (ndc.z + projParams.z);
+    vec3 viewPos = vec3(ndc.xy * -viewZ / projParams.xy, viewZ);
+
+    vec4 previous = reprojection * vec4(viewPos, 1.0);
+    Velocity = uv - (previous.xy / previous.w * 0.5 + 0.5);
+}
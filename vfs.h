@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "embedded_assets.h"
+
+// Read-only view of an asset. Embedded assets point straight into the binary, files read from disk own their bytes.
+struct AssetData
+{
+    const unsigned char* data = nullptr;
+    std::size_t size = 0;
+    std::vector<unsigned char> storage;
+
+    AssetData() = default;
+    AssetData(const unsigned char* data, std::size_t size) : data(data), size(size) {}
+    AssetData(std::vector<unsigned char>&& bytes) : storage(std::move(bytes))
+    {
+        data = storage.data();
+        size = storage.size();
+    }
+    AssetData(AssetData&& other) noexcept { *this = std::move(other); }
+    AssetData& operator=(AssetData&& other) noexcept
+    {
+        // Moving a vector keeps its buffer, so data stays valid for disk assets too
+        storage = std::move(other.storage);
+        data = other.data;
+        size = other.size;
+        other.data = nullptr;
+        other.size = 0;
+        return *this;
+    }
+
+    explicit operator bool() const { return data != nullptr; }
+    std::string_view text() const { return {reinterpret_cast<const char*>(data), size}; }
+};
+
+// Asset paths are relative to the project root, "./rect.vert" and "rect.vert" name the same asset.
+inline std::string_view normalizeAssetPath(std::string_view path)
+{
+    while (path.substr(0, 2) == "./")
+    {
+        path.remove_prefix(2);
+    }
+    return path;
+}
+
+inline AssetData readAssetFromDisk(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return {};
+    }
+    return AssetData{std::vector<unsigned char>{std::istreambuf_iterator<char>(file), {}}};
+}
+
+// Serve an asset compiled into the binary. Development builds fall back to the working directory for anything
+// that was not embedded, release builds never touch the disk.
+inline AssetData openAsset(const std::string& path)
+{
+    const auto name = normalizeAssetPath(path);
+    for (const auto& asset : embeddedAssets)
+    {
+        if (name == asset.path)
+        {
+            return AssetData{asset.data, asset.size};
+        }
+    }
+
+#ifdef CLAUSTROPHOBIA_DEV_ASSETS
+    if (auto asset = readAssetFromDisk(path))
+    {
+        return asset;
+    }
+#endif
+
+    std::cout << "ERROR::VFS::ASSET_NOT_FOUND: " << path << std::endl;
+    return {};
+}